@@ -0,0 +1,284 @@
+#include "corpus_ingest.h"
+
+#include <charconv>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+#ifdef _WIN32
+MappedFile::MappedFile(const string& path) {
+    const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw runtime_error("Can't open "s + path);
+    }
+    LARGE_INTEGER file_size{};
+    GetFileSizeEx(file, &file_size);
+    size_ = static_cast<size_t>(file_size.QuadPart);
+    if (size_ > 0) {
+        const HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping != nullptr) {
+            data_ = static_cast<const char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+            // The view keeps the mapping alive
+            CloseHandle(mapping);
+        }
+    }
+    CloseHandle(file);
+    if (size_ > 0 && data_ == nullptr) {
+        throw runtime_error("Can't map "s + path);
+    }
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        UnmapViewOfFile(data_);
+    }
+}
+#else
+MappedFile::MappedFile(const string& path) {
+    const int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error("Can't open "s + path);
+    }
+    struct stat file_stat {};
+    if (fstat(fd, &file_stat) != 0) {
+        close(fd);
+        throw runtime_error("Can't stat "s + path);
+    }
+    size_ = static_cast<size_t>(file_stat.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data == MAP_FAILED) {
+            close(fd);
+            throw runtime_error("Can't map "s + path);
+        }
+        madvise(data, size_, MADV_SEQUENTIAL);
+        data_ = static_cast<const char*>(data);
+    }
+    // The mapping stays valid after the descriptor is closed
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (data_ != nullptr) {
+        munmap(const_cast<char*>(data_), size_);
+    }
+}
+#endif
+
+string_view MappedFile::GetContents() const {
+    return { data_, size_ };
+}
+
+namespace {
+struct ParsedDocument {
+    int id;
+    string_view text;
+    DocumentStatus status;
+    vector<int> ratings;
+    // Split, validated and stop-word filtered on the parser thread
+    vector<string_view> words;
+};
+
+struct ParsedBatch {
+    vector<ParsedDocument> documents;
+    int malformed = 0;
+};
+
+// Bounded hand-off between the parser thread and the indexer
+class BatchQueue {
+public:
+    explicit BatchQueue(size_t capacity)
+        : capacity_(max(capacity, size_t(1))) {
+    }
+
+    void Push(ParsedBatch batch) {
+        unique_lock lock(mutex_);
+        has_space_.wait(lock, [this] { return batches_.size() < capacity_; });
+        batches_.push_back(move(batch));
+        has_batches_.notify_one();
+    }
+
+    // Empty once the producer has finished and everything was taken
+    optional<ParsedBatch> Pop() {
+        unique_lock lock(mutex_);
+        has_batches_.wait(lock, [this] { return finished_ || !batches_.empty(); });
+        if (batches_.empty()) {
+            return nullopt;
+        }
+        ParsedBatch batch = move(batches_.front());
+        batches_.pop_front();
+        has_space_.notify_one();
+        return batch;
+    }
+
+    void Finish() {
+        lock_guard guard(mutex_);
+        finished_ = true;
+        has_batches_.notify_all();
+    }
+
+private:
+    const size_t capacity_;
+    mutex mutex_;
+    condition_variable has_space_;
+    condition_variable has_batches_;
+    deque<ParsedBatch> batches_;
+    bool finished_ = false;
+};
+
+string_view NextField(string_view& line) {
+    const size_t tab = line.find('\t');
+    const string_view field = line.substr(0, tab);
+    line.remove_prefix(tab == string_view::npos ? line.size() : tab + 1);
+    return field;
+}
+
+bool ParseInt(string_view text, int& value) {
+    const auto result = from_chars(text.data(), text.data() + text.size(), value);
+    return result.ec == errc() && result.ptr == text.data() + text.size();
+}
+
+bool ParseStatus(string_view text, DocumentStatus& status) {
+    static const pair<string_view, DocumentStatus> names[] = {
+        { "ACTUAL"sv, DocumentStatus::ACTUAL },
+        { "IRRELEVANT"sv, DocumentStatus::IRRELEVANT },
+        { "BANNED"sv, DocumentStatus::BANNED },
+        { "REMOVED"sv, DocumentStatus::REMOVED },
+    };
+    for (const auto& [name, value] : names) {
+        if (text == name) {
+            status = value;
+            return true;
+        }
+    }
+    int number = 0;
+    if (ParseInt(text, number) && number >= 0 && number <= static_cast<int>(DocumentStatus::REMOVED)) {
+        status = static_cast<DocumentStatus>(number);
+        return true;
+    }
+    return false;
+}
+
+bool ParseFramedLine(string_view line, ParsedDocument& document) {
+    const string_view id = NextField(line);
+    const string_view status = NextField(line);
+    const string_view ratings = NextField(line);
+    if (!ParseInt(id, document.id) || !ParseStatus(status, document.status)) {
+        return false;
+    }
+    for (const string_view rating : SplitIntoWordsView(ratings)) {
+        int value = 0;
+        if (!ParseInt(rating, value)) {
+            return false;
+        }
+        document.ratings.push_back(value);
+    }
+    document.text = line;
+    return true;
+}
+
+void ParseCorpus(string_view contents, const SearchServer& search_server, const IngestOptions& options, BatchQueue& queue) {
+    int next_id = options.first_document_id;
+    ParsedBatch batch;
+    while (!contents.empty()) {
+        const size_t line_end = contents.find('\n');
+        string_view line = contents.substr(0, line_end);
+        contents.remove_prefix(line_end == string_view::npos ? contents.size() : line_end + 1);
+        if (!line.empty() && line.back() == '\r') {
+            line.remove_suffix(1);
+        }
+        if (line.empty()) {
+            continue;
+        }
+
+        ParsedDocument document{ next_id, line, DocumentStatus::ACTUAL, {}, {} };
+        if (options.format == CorpusFormat::LINES) {
+            ++next_id;
+        }
+        else if (!ParseFramedLine(line, document)) {
+            ++batch.malformed;
+            continue;
+        }
+        try {
+            document.words = search_server.SplitIntoWordsNoStop(document.text);
+        }
+        catch (const invalid_argument&) {
+            ++batch.malformed;
+            continue;
+        }
+        batch.documents.push_back(move(document));
+        if (batch.documents.size() >= options.batch_size) {
+            queue.Push(move(batch));
+            batch = {};
+        }
+    }
+    if (!batch.documents.empty() || batch.malformed > 0) {
+        queue.Push(move(batch));
+    }
+}
+}
+
+IngestStats IngestCorpus(const string& path, SearchServer& search_server, const IngestOptions& options) {
+    const MappedFile file(path);
+    const string_view contents = file.GetContents();
+
+    BatchQueue queue(options.max_queued_batches);
+    exception_ptr parser_error;
+    thread parser([&] {
+        try {
+            ParseCorpus(contents, search_server, options, queue);
+        }
+        catch (...) {
+            parser_error = current_exception();
+        }
+        queue.Finish();
+        });
+
+    IngestStats stats;
+    stats.bytes = contents.size();
+    try {
+        while (auto batch = queue.Pop()) {
+            stats.skipped_documents += batch->malformed;
+            for (const ParsedDocument& document : batch->documents) {
+                try {
+                    search_server.AddDocument(document.id, document.text, document.words, document.status, document.ratings);
+                    ++stats.indexed_documents;
+                }
+                catch (const invalid_argument&) {
+                    ++stats.skipped_documents;
+                }
+            }
+        }
+    }
+    catch (...) {
+        // Let the parser run to the end so it can be joined
+        while (queue.Pop()) {
+        }
+        parser.join();
+        throw;
+    }
+    parser.join();
+    if (parser_error) {
+        rethrow_exception(parser_error);
+    }
+    return stats;
+}
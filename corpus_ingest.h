@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include "search_server.h"
+
+// Read-only memory mapping of a whole file
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    ~MappedFile();
+
+    std::string_view GetContents() const;
+
+private:
+    const char* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+enum class CorpusFormat {
+    // One document per line; ids are assigned consecutively, status ACTUAL, no ratings
+    LINES,
+    // One document per line: <id>\t<status>\t<ratings separated by spaces>\t<text>
+    // Status is ACTUAL, IRRELEVANT, BANNED, REMOVED or its number
+    FRAMED
+};
+
+struct IngestOptions {
+    CorpusFormat format = CorpusFormat::LINES;
+    // First id given out in LINES format
+    int first_document_id = 0;
+    // Documents handed from the parser to the indexer at a time
+    size_t batch_size = 4096;
+    // Parsed batches allowed to wait for the indexer
+    size_t max_queued_batches = 4;
+};
+
+struct IngestStats {
+    int indexed_documents = 0;
+    // Empty lines are ignored; malformed lines and documents AddDocument rejects are skipped
+    int skipped_documents = 0;
+    size_t bytes = 0;
+};
+
+// Maps the corpus file and streams it into search_server: one thread parses batches straight
+// from the mapped pages, splitting and validating the words, while the calling thread indexes
+// the previous ones. Document texts are never copied; only words new to the dictionary are.
+IngestStats IngestCorpus(const std::string& path, SearchServer& search_server, const IngestOptions& options = {});
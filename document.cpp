@@ -2,6 +2,9 @@
 
 Document::Document() = default;
 
+Document::Document(const SearchHit& hit)
+    : id(hit.id), relevance(hit.relevance), rating(hit.rating) {}
+
 Document::Document(const int doc_id, const double doc_relevance, const int doc_rating)
     : id(doc_id), relevance(doc_relevance), rating(doc_rating) {}
 
@@ -44,4 +47,15 @@ std::ostream& operator<<(std::ostream & out, const DocumentStatus status) {
 std::ostream& operator<<(std::ostream & out, const Document & document) {
     PrintDocument(document);
     return out;
+}
+
+std::ostream& operator<<(std::ostream & out, const SearchHit & hit) {
+    using namespace std::string_literals;
+
+    out << "{ "s
+        << "document_id = "s << hit.id << ", "s
+        << "relevance = "s << hit.relevance << ", "s
+        << "rating = "s << hit.rating
+        << " }"s;
+    return out;
 }
\ No newline at end of file
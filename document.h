@@ -1,6 +1,7 @@
 #pragma once
 
 #include <iostream>
+#include <type_traits>
 #include <vector>
 #include <string>
 
@@ -11,8 +12,18 @@ enum class DocumentStatus {
 	REMOVED
 };
 
+// Search result without Document's text and ratings: trivially copyable,
+// so result buffers can be reused and copied with memcpy
+struct SearchHit {
+	int id = 0;
+	double relevance = 0.0;
+	int rating = 0;
+};
+static_assert(std::is_trivially_copyable_v<SearchHit>);
+
 struct Document {
 	Document();
+	explicit Document(const SearchHit& hit);
 	Document(const int doc_id, const double doc_relevance, const int doc_rating);
 	Document(const int doc_id, const double doc_relevance, const int doc_rating, const DocumentStatus doc_status);
 	Document(const int doc_id, const std::string& doc_text, const std::vector<int>& doc_ratings, const DocumentStatus doc_status);
@@ -28,3 +39,4 @@ struct Document {
 void PrintDocument(const Document& document);
 std::ostream& operator<<(std::ostream& out, const DocumentStatus status);
 std::ostream& operator<<(std::ostream& out, const Document& document);
+std::ostream& operator<<(std::ostream& out, const SearchHit& hit);
@@ -0,0 +1,197 @@
+#include "durable_storage.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+
+namespace {
+// BinaryWriter hands its buffer to the file in pieces of about this size
+const size_t WRITE_BUFFER_SIZE = 1 << 20;
+}
+
+#ifdef _WIN32
+DurableFile::DurableFile(const string& path, bool truncate)
+    : path_(path)
+{
+    const HANDLE file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, nullptr,
+        truncate ? CREATE_ALWAYS : OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        throw runtime_error("Can't open "s + path);
+    }
+    handle_ = file;
+    LARGE_INTEGER end{};
+    SetFilePointerEx(file, end, nullptr, FILE_END);
+}
+
+DurableFile::~DurableFile() {
+    CloseHandle(static_cast<HANDLE>(handle_));
+}
+
+void DurableFile::Append(string_view data) {
+    while (!data.empty()) {
+        const DWORD chunk = static_cast<DWORD>(min(data.size(), size_t(1) << 30));
+        DWORD written = 0;
+        if (!WriteFile(static_cast<HANDLE>(handle_), data.data(), chunk, &written, nullptr)) {
+            throw runtime_error("Can't write to "s + path_);
+        }
+        data.remove_prefix(written);
+    }
+}
+
+void DurableFile::Sync() {
+    if (!FlushFileBuffers(static_cast<HANDLE>(handle_))) {
+        throw runtime_error("Can't sync "s + path_);
+    }
+}
+
+void DurableFile::Truncate(uint64_t size) {
+    LARGE_INTEGER position{};
+    position.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(static_cast<HANDLE>(handle_), position, nullptr, FILE_BEGIN) || !SetEndOfFile(static_cast<HANDLE>(handle_))) {
+        throw runtime_error("Can't truncate "s + path_);
+    }
+    Sync();
+}
+
+void ReplaceFileDurably(const string& from, const string& to) {
+    // Write-through makes the rename itself durable before the call returns
+    if (!MoveFileExA(from.c_str(), to.c_str(), MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH)) {
+        throw runtime_error("Can't rename "s + from + " to "s + to);
+    }
+}
+#else
+DurableFile::DurableFile(const string& path, bool truncate)
+    : path_(path)
+{
+    fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (truncate ? O_TRUNC : 0), 0644);
+    if (fd_ < 0) {
+        throw runtime_error("Can't open "s + path + ": "s + strerror(errno));
+    }
+}
+
+DurableFile::~DurableFile() {
+    close(fd_);
+}
+
+void DurableFile::Append(string_view data) {
+    while (!data.empty()) {
+        const ssize_t written = write(fd_, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw runtime_error("Can't write to "s + path_ + ": "s + strerror(errno));
+        }
+        data.remove_prefix(static_cast<size_t>(written));
+    }
+}
+
+void DurableFile::Sync() {
+#ifdef __APPLE__
+    // fsync only reaches the drive's cache on macOS
+    const int result = fcntl(fd_, F_FULLFSYNC);
+#elif defined(__linux__)
+    const int result = fdatasync(fd_);
+#else
+    const int result = fsync(fd_);
+#endif
+    if (result != 0) {
+        throw runtime_error("Can't sync "s + path_ + ": "s + strerror(errno));
+    }
+}
+
+void DurableFile::Truncate(uint64_t size) {
+    if (ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+        throw runtime_error("Can't truncate "s + path_ + ": "s + strerror(errno));
+    }
+    Sync();
+}
+
+void ReplaceFileDurably(const string& from, const string& to) {
+    if (rename(from.c_str(), to.c_str()) != 0) {
+        throw runtime_error("Can't rename "s + from + " to "s + to + ": "s + strerror(errno));
+    }
+    // The new directory entry is only durable once the directory itself is synced
+    const size_t slash = to.rfind('/');
+    const string directory = slash == string::npos ? "."s : slash == 0 ? "/"s : to.substr(0, slash);
+    const int fd = open(directory.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error("Can't open directory "s + directory + ": "s + strerror(errno));
+    }
+    const int result = fsync(fd);
+    close(fd);
+    if (result != 0) {
+        throw runtime_error("Can't sync directory "s + directory + ": "s + strerror(errno));
+    }
+}
+#endif
+
+const string& DurableFile::GetPath() const {
+    return path_;
+}
+
+BinaryWriter::BinaryWriter(DurableFile& file)
+    : file_(file)
+{
+}
+
+void BinaryWriter::WriteString(string_view str) {
+    Write(static_cast<uint64_t>(str.size()));
+    WriteBytes(str.data(), str.size());
+}
+
+void BinaryWriter::Flush() {
+    file_.Append(buffer_);
+    buffer_.clear();
+}
+
+void BinaryWriter::WriteBytes(const void* data, size_t size) {
+    buffer_.append(static_cast<const char*>(data), size);
+    if (buffer_.size() >= WRITE_BUFFER_SIZE) {
+        Flush();
+    }
+}
+
+BinaryReader::BinaryReader(istream& in)
+    : in_(in)
+{
+    const auto position = in_.tellg();
+    in_.seekg(0, ios::end);
+    const auto end = in_.tellg();
+    in_.seekg(position);
+    if (position >= 0 && end >= position) {
+        remaining_size_ = static_cast<uint64_t>(end - position);
+    }
+}
+
+string BinaryReader::ReadString() {
+    string str(ReadCount(1), '\0');
+    ReadBytes(str.data(), str.size());
+    return str;
+}
+
+void BinaryReader::ReadBytes(void* data, size_t size) {
+    if (size > remaining_size_ || !in_.read(static_cast<char*>(data), static_cast<streamsize>(size))) {
+        throw runtime_error("Unexpected end of file"s);
+    }
+    remaining_size_ -= size;
+}
+
+size_t BinaryReader::ReadCount(size_t element_size) {
+    const uint64_t count = Read<uint64_t>();
+    if (count > remaining_size_ / element_size) {
+        throw runtime_error("Unexpected end of file"s);
+    }
+    return static_cast<size_t>(count);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+// Append-only file whose Sync() returns once the data has reached the disk
+// (fdatasync on POSIX, FlushFileBuffers on Windows). Throws std::runtime_error on I/O errors
+class DurableFile {
+public:
+    // truncate = true empties the file if it exists
+    DurableFile(const std::string& path, bool truncate);
+    DurableFile(const DurableFile&) = delete;
+    DurableFile& operator=(const DurableFile&) = delete;
+    ~DurableFile();
+
+    void Append(std::string_view data);
+    void Sync();
+    // Cuts the file to size bytes and syncs that; later appends go to the new end
+    void Truncate(uint64_t size = 0);
+    const std::string& GetPath() const;
+
+private:
+    std::string path_;
+#ifdef _WIN32
+    void* handle_ = nullptr;
+#else
+    int fd_ = -1;
+#endif
+};
+
+// Renames from over to and syncs the directory, so after a crash to is either
+// the old file or the complete new one
+void ReplaceFileDurably(const std::string& from, const std::string& to);
+
+// Buffered writer of snapshot files. Values are stored in the machine's own byte order,
+// so a snapshot is read back on the same platform that wrote it
+class BinaryWriter {
+public:
+    explicit BinaryWriter(DurableFile& file);
+
+    template <typename T>
+    void Write(const T& value);
+    // Element count followed by the elements
+    template <typename T>
+    void WriteVector(const std::vector<T>& values);
+    void WriteString(std::string_view str);
+    // Hands the buffered bytes to the file; Sync() the file afterwards to make them durable
+    void Flush();
+
+private:
+    DurableFile& file_;
+    std::string buffer_;
+
+    void WriteBytes(const void* data, size_t size);
+};
+
+// Reads what BinaryWriter wrote; throws std::runtime_error when the stream ends early
+class BinaryReader {
+public:
+    explicit BinaryReader(std::istream& in);
+
+    template <typename T>
+    T Read();
+    template <typename T>
+    std::vector<T> ReadVector();
+    std::string ReadString();
+
+private:
+    std::istream& in_;
+    // Bytes left in the stream, so a damaged count can't make a huge allocation
+    uint64_t remaining_size_ = 0;
+
+    void ReadBytes(void* data, size_t size);
+    size_t ReadCount(size_t element_size);
+};
+
+template <typename T>
+void BinaryWriter::Write(const T& value) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    WriteBytes(&value, sizeof(T));
+}
+
+template <typename T>
+void BinaryWriter::WriteVector(const std::vector<T>& values) {
+    static_assert(std::is_trivially_copyable_v<T>);
+    Write(static_cast<uint64_t>(values.size()));
+    WriteBytes(values.data(), values.size() * sizeof(T));
+}
+
+template <typename T>
+T BinaryReader::Read() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    ReadBytes(&value, sizeof(T));
+    return value;
+}
+
+template <typename T>
+std::vector<T> BinaryReader::ReadVector() {
+    static_assert(std::is_trivially_copyable_v<T>);
+    std::vector<T> values(ReadCount(sizeof(T)));
+    ReadBytes(values.data(), values.size() * sizeof(T));
+    return values;
+}
@@ -0,0 +1,278 @@
+#include "index_segment.h"
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+
+using namespace std;
+
+namespace {
+[[noreturn]] void ThrowDamagedSegment() {
+    throw runtime_error("Damaged index segment"s);
+}
+
+template <typename Offset>
+bool AreValidOffsets(const vector<Offset>& offsets, size_t entry_count, size_t element_count) {
+    return offsets.size() == entry_count + 1 && offsets.front() == 0 && offsets.back() == element_count
+        && is_sorted(offsets.begin(), offsets.end());
+}
+}
+
+const Posting* PostingList::Seek(const Posting* position, int document_index) const {
+    if (position == last_ || position->document_index >= document_index) {
+        return position;
+    }
+    // position is before the target: double the step until a probe reaches it,
+    // then binary search the last step
+    size_t step = 1;
+    while (true) {
+        const Posting* probe = static_cast<size_t>(last_ - position) > step ? position + step : last_;
+        if (probe == last_ || probe->document_index >= document_index) {
+            return lower_bound(position + 1, probe, document_index, [](const Posting& posting, int index) {
+                return posting.document_index < index;
+                });
+        }
+        position = probe;
+        step *= 2;
+    }
+}
+
+void IndexSegment::AddDocument(const SegmentDocument& document, const vector<TermFrequency>& term_freqs) {
+    const int document_index = static_cast<int>(documents_.size());
+    documents_.push_back(document);
+    tombstones_.push_back(false);
+    // Ids mostly arrive in ascending order, which makes this an append
+    const auto position = upper_bound(id_to_index_.begin(), id_to_index_.end(), make_pair(document.id, document_index));
+    id_to_index_.insert(position, { document.id, document_index });
+
+    for (const TermFrequency& term_freq : term_freqs) {
+        GrowingPostings& growing = growing_postings_[term_freq.term_id];
+        growing.postings.push_back({ document_index, term_freq.term_freq });
+        growing.max_term_freq = max(growing.max_term_freq, term_freq.term_freq);
+    }
+    document_terms_.insert(document_terms_.end(), term_freqs.begin(), term_freqs.end());
+    document_term_offsets_.push_back(document_terms_.size());
+}
+
+void IndexSegment::Seal() {
+    size_t posting_count = 0;
+    term_ids_.reserve(growing_postings_.size());
+    for (const auto& [term_id, growing] : growing_postings_) {
+        term_ids_.push_back(term_id);
+        posting_count += growing.postings.size();
+    }
+    sort(term_ids_.begin(), term_ids_.end());
+
+    term_offsets_.reserve(term_ids_.size() + 1);
+    term_max_freqs_.reserve(term_ids_.size());
+    postings_.reserve(posting_count);
+    for (const int term_id : term_ids_) {
+        const GrowingPostings& growing = growing_postings_.at(term_id);
+        postings_.insert(postings_.end(), growing.postings.begin(), growing.postings.end());
+        term_offsets_.push_back(postings_.size());
+        term_max_freqs_.push_back(growing.max_term_freq);
+    }
+    unordered_map<int, GrowingPostings>().swap(growing_postings_);
+
+    // The forward index keeps its storage: DocumentTermsView points into it
+    id_to_index_.shrink_to_fit();
+    sealed_ = true;
+}
+
+bool IndexSegment::IsSealed() const {
+    return sealed_;
+}
+
+size_t IndexSegment::GetDocumentCount() const {
+    return documents_.size();
+}
+
+size_t IndexSegment::GetDeletedCount() const {
+    return deleted_count_;
+}
+
+const SegmentDocument& IndexSegment::GetDocument(int document_index) const {
+    return documents_[document_index];
+}
+
+void IndexSegment::MarkDeleted(int document_index) {
+    if (!tombstones_[document_index]) {
+        tombstones_[document_index] = true;
+        ++deleted_count_;
+    }
+}
+
+const vector<bool>& IndexSegment::GetTombstones() const {
+    return tombstones_;
+}
+
+int IndexSegment::FindDocument(int document_id) const {
+    auto it = lower_bound(id_to_index_.begin(), id_to_index_.end(), make_pair(document_id, numeric_limits<int>::min()));
+    for (; it != id_to_index_.end() && it->first == document_id; ++it) {
+        if (!tombstones_[it->second]) {
+            return it->second;
+        }
+    }
+    return -1;
+}
+
+PostingList IndexSegment::GetPostings(int term_id) const {
+    if (!sealed_) {
+        const auto it = growing_postings_.find(term_id);
+        if (it == growing_postings_.end()) {
+            return {};
+        }
+        const auto& postings = it->second.postings;
+        return { postings.data(), postings.data() + postings.size(), it->second.max_term_freq };
+    }
+    const auto it = lower_bound(term_ids_.begin(), term_ids_.end(), term_id);
+    if (it == term_ids_.end() || *it != term_id) {
+        return {};
+    }
+    const size_t term_index = it - term_ids_.begin();
+    return { postings_.data() + term_offsets_[term_index], postings_.data() + term_offsets_[term_index + 1], term_max_freqs_[term_index] };
+}
+
+pair<const TermFrequency*, const TermFrequency*> IndexSegment::GetTermFreqs(int document_index) const {
+    const TermFrequency* terms = document_terms_.data();
+    return { terms + document_term_offsets_[document_index], terms + document_term_offsets_[document_index + 1] };
+}
+
+size_t IndexSegment::GetPostingBytes() const {
+    size_t bytes = postings_.capacity() * sizeof(Posting) + term_ids_.capacity() * sizeof(int)
+        + term_offsets_.capacity() * sizeof(size_t) + term_max_freqs_.capacity() * sizeof(double);
+    // A hash node holds the value and the link to the next node, plus a bucket pointer
+    bytes += growing_postings_.bucket_count() * sizeof(void*);
+    for (const auto& [term_id, growing] : growing_postings_) {
+        bytes += sizeof(void*) + sizeof(pair<const int, GrowingPostings>) + growing.postings.capacity() * sizeof(Posting);
+    }
+    return bytes;
+}
+
+size_t IndexSegment::GetForwardIndexBytes() const {
+    return document_term_offsets_.capacity() * sizeof(size_t) + document_terms_.capacity() * sizeof(TermFrequency);
+}
+
+size_t IndexSegment::GetDocumentBytes() const {
+    return documents_.capacity() * sizeof(SegmentDocument) + tombstones_.capacity() / 8
+        + id_to_index_.capacity() * sizeof(pair<int, int>);
+}
+
+shared_ptr<IndexSegment> IndexSegment::Merge(const vector<const IndexSegment*>& segments,
+    const vector<vector<bool>>& tombstones, vector<vector<int>>& index_maps) {
+    auto merged = make_shared<IndexSegment>();
+    index_maps.assign(segments.size(), {});
+    size_t posting_count = 0;
+    vector<int> term_ids;
+    for (size_t i = 0; i < segments.size(); ++i) {
+        const IndexSegment& segment = *segments[i];
+        auto& index_map = index_maps[i];
+        index_map.assign(segment.documents_.size(), -1);
+        for (size_t j = 0; j < segment.documents_.size(); ++j) {
+            if (tombstones[i][j]) {
+                continue;
+            }
+            index_map[j] = static_cast<int>(merged->documents_.size());
+            merged->documents_.push_back(segment.documents_[j]);
+            const auto [first, last] = segment.GetTermFreqs(static_cast<int>(j));
+            merged->document_terms_.insert(merged->document_terms_.end(), first, last);
+            merged->document_term_offsets_.push_back(merged->document_terms_.size());
+        }
+        posting_count += segment.postings_.size();
+        term_ids.insert(term_ids.end(), segment.term_ids_.begin(), segment.term_ids_.end());
+    }
+    merged->tombstones_.assign(merged->documents_.size(), false);
+    merged->RebuildIdIndex();
+
+    sort(term_ids.begin(), term_ids.end());
+    term_ids.erase(unique(term_ids.begin(), term_ids.end()), term_ids.end());
+    merged->postings_.reserve(posting_count);
+    // Each input's term list is walked once, in step with term_ids. Inputs are concatenated
+    // in order, so the postings of every term come out sorted by the new index
+    vector<size_t> term_cursors(segments.size(), 0);
+    for (const int term_id : term_ids) {
+        const size_t first_posting = merged->postings_.size();
+        double max_term_freq = 0.0;
+        for (size_t i = 0; i < segments.size(); ++i) {
+            const IndexSegment& segment = *segments[i];
+            size_t& cursor = term_cursors[i];
+            if (cursor == segment.term_ids_.size() || segment.term_ids_[cursor] != term_id) {
+                continue;
+            }
+            for (size_t p = segment.term_offsets_[cursor]; p < segment.term_offsets_[cursor + 1]; ++p) {
+                const Posting& posting = segment.postings_[p];
+                const int document_index = index_maps[i][posting.document_index];
+                if (document_index >= 0) {
+                    merged->postings_.push_back({ document_index, posting.term_freq });
+                    max_term_freq = max(max_term_freq, posting.term_freq);
+                }
+            }
+            ++cursor;
+        }
+        // Terms whose documents were all deleted disappear
+        if (merged->postings_.size() > first_posting) {
+            merged->term_ids_.push_back(term_id);
+            merged->term_offsets_.push_back(merged->postings_.size());
+            merged->term_max_freqs_.push_back(max_term_freq);
+        }
+    }
+    merged->postings_.shrink_to_fit();
+    merged->sealed_ = true;
+    return merged;
+}
+
+void IndexSegment::Save(BinaryWriter& writer) const {
+    writer.WriteVector(documents_);
+    writer.WriteVector(vector<uint8_t>(tombstones_.begin(), tombstones_.end()));
+    writer.WriteVector(document_term_offsets_);
+    writer.WriteVector(document_terms_);
+    writer.WriteVector(term_ids_);
+    writer.WriteVector(term_offsets_);
+    writer.WriteVector(term_max_freqs_);
+    writer.WriteVector(postings_);
+}
+
+shared_ptr<IndexSegment> IndexSegment::Load(BinaryReader& reader, size_t term_count) {
+    auto segment = make_shared<IndexSegment>();
+    segment->documents_ = reader.ReadVector<SegmentDocument>();
+    const auto tombstones = reader.ReadVector<uint8_t>();
+    segment->document_term_offsets_ = reader.ReadVector<size_t>();
+    segment->document_terms_ = reader.ReadVector<TermFrequency>();
+    segment->term_ids_ = reader.ReadVector<int>();
+    segment->term_offsets_ = reader.ReadVector<size_t>();
+    segment->term_max_freqs_ = reader.ReadVector<double>();
+    segment->postings_ = reader.ReadVector<Posting>();
+
+    // Everything the searches index with must be in range
+    const size_t document_count = segment->documents_.size();
+    const bool is_valid = tombstones.size() == document_count
+        && AreValidOffsets(segment->document_term_offsets_, document_count, segment->document_terms_.size())
+        && all_of(segment->document_terms_.begin(), segment->document_terms_.end(), [term_count](const TermFrequency& term_freq) {
+            return term_freq.term_id >= 0 && static_cast<size_t>(term_freq.term_id) < term_count;
+            })
+        && AreValidOffsets(segment->term_offsets_, segment->term_ids_.size(), segment->postings_.size())
+        && segment->term_max_freqs_.size() == segment->term_ids_.size()
+        && adjacent_find(segment->term_ids_.begin(), segment->term_ids_.end(), greater_equal<int>()) == segment->term_ids_.end()
+        && (segment->term_ids_.empty() || (segment->term_ids_.front() >= 0 && static_cast<size_t>(segment->term_ids_.back()) < term_count))
+        && all_of(segment->postings_.begin(), segment->postings_.end(), [document_count](const Posting& posting) {
+            return posting.document_index >= 0 && static_cast<size_t>(posting.document_index) < document_count;
+            });
+    if (!is_valid) {
+        ThrowDamagedSegment();
+    }
+
+    segment->tombstones_.assign(tombstones.begin(), tombstones.end());
+    segment->deleted_count_ = static_cast<size_t>(count(segment->tombstones_.begin(), segment->tombstones_.end(), true));
+    segment->RebuildIdIndex();
+    segment->sealed_ = true;
+    return segment;
+}
+
+void IndexSegment::RebuildIdIndex() {
+    id_to_index_.clear();
+    id_to_index_.reserve(documents_.size());
+    for (size_t i = 0; i < documents_.size(); ++i) {
+        id_to_index_.push_back({ documents_[i].id, static_cast<int>(i) });
+    }
+    sort(id_to_index_.begin(), id_to_index_.end());
+}
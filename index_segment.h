@@ -0,0 +1,139 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "document.h"
+#include "durable_storage.h"
+
+struct TermFrequency {
+    int term_id;
+    double term_freq;
+};
+
+struct Posting {
+    // Position of the document within its segment
+    int document_index;
+    double term_freq;
+};
+
+// One term's postings within one segment, ordered by document index
+class PostingList {
+public:
+    PostingList() = default;
+    PostingList(const Posting* first, const Posting* last, double max_term_freq)
+        : first_(first), last_(last), max_term_freq_(max_term_freq) {
+    }
+
+    const Posting* begin() const {
+        return first_;
+    }
+    const Posting* end() const {
+        return last_;
+    }
+    size_t size() const {
+        return last_ - first_;
+    }
+    bool empty() const {
+        return first_ == last_;
+    }
+    // Bound for the scores the list can contribute
+    double GetMaxTermFreq() const {
+        return max_term_freq_;
+    }
+
+    // Postings of the documents in [first_index, last_index)
+    PostingList Slice(int first_index, int last_index) const {
+        const Posting* first = Seek(first_, first_index);
+        return { first, Seek(first, last_index), max_term_freq_ };
+    }
+    // First posting at or after position whose document index is at least document_index.
+    // Gallops from position, so walking a list in order costs O(log gap) per step
+    const Posting* Seek(const Posting* position, int document_index) const;
+    bool Contains(int document_index) const {
+        const Posting* position = Seek(first_, document_index);
+        return position != last_ && position->document_index == document_index;
+    }
+
+private:
+    const Posting* first_ = nullptr;
+    const Posting* last_ = nullptr;
+    double max_term_freq_ = 0.0;
+};
+
+struct SegmentDocument {
+    int id;
+    int rating;
+    DocumentStatus status;
+    int word_count;
+};
+
+// Part of the index: some of the documents with their forward and inverted entries.
+// Documents are appended to a mutable segment under local indexes that follow insertion
+// order. Seal() packs the postings into flat arrays, after which only the tombstones
+// change: removing a document only marks it, and the merge that rewrites the segment drops it.
+class IndexSegment {
+public:
+    // term_freqs must be sorted by term id. Only before Seal()
+    void AddDocument(const SegmentDocument& document, const std::vector<TermFrequency>& term_freqs);
+    void Seal();
+    bool IsSealed() const;
+
+    // Deleted documents included
+    size_t GetDocumentCount() const;
+    size_t GetDeletedCount() const;
+    const SegmentDocument& GetDocument(int document_index) const;
+    bool IsDeleted(int document_index) const {
+        return tombstones_[document_index];
+    }
+    void MarkDeleted(int document_index);
+    const std::vector<bool>& GetTombstones() const;
+    // Index of the live document with this id, -1 if the segment has none
+    int FindDocument(int document_id) const;
+
+    PostingList GetPostings(int term_id) const;
+    // The document's (term id, term frequency) pairs, sorted by term id
+    std::pair<const TermFrequency*, const TermFrequency*> GetTermFreqs(int document_index) const;
+
+    size_t GetPostingBytes() const;
+    size_t GetForwardIndexBytes() const;
+    size_t GetDocumentBytes() const;
+
+    // Sealed segment holding the documents of the sealed segments that are live according to
+    // tombstones[i], which may be older than segments[i]'s own. Documents keep their order.
+    // index_maps[i][j] receives the new index of document j of segments[i], or -1 if it was dropped
+    static std::shared_ptr<IndexSegment> Merge(const std::vector<const IndexSegment*>& segments,
+        const std::vector<std::vector<bool>>& tombstones, std::vector<std::vector<int>>& index_maps);
+
+    // Only sealed segments are saved. Load throws std::runtime_error for a damaged segment
+    void Save(BinaryWriter& writer) const;
+    static std::shared_ptr<IndexSegment> Load(BinaryReader& reader, size_t term_count);
+
+private:
+    struct GrowingPostings {
+        std::vector<Posting> postings;
+        double max_term_freq = 0.0;
+    };
+
+    std::vector<SegmentDocument> documents_;
+    std::vector<bool> tombstones_;
+    size_t deleted_count_ = 0;
+    // (document id, index) sorted by id. An id repeats if it was removed and added again
+    std::vector<std::pair<int, int>> id_to_index_;
+    // Forward index: document i owns document_terms_[document_term_offsets_[i], document_term_offsets_[i + 1])
+    std::vector<size_t> document_term_offsets_ = { 0 };
+    std::vector<TermFrequency> document_terms_;
+    // Inverted index while the segment is mutable
+    std::unordered_map<int, GrowingPostings> growing_postings_;
+    // Inverted index once sealed: term_ids_[i] owns postings_[term_offsets_[i], term_offsets_[i + 1])
+    std::vector<int> term_ids_;
+    std::vector<size_t> term_offsets_ = { 0 };
+    std::vector<double> term_max_freqs_;
+    std::vector<Posting> postings_;
+    bool sealed_ = false;
+
+    void RebuildIdIndex();
+};
@@ -0,0 +1,233 @@
+// Load generator for search_server_daemon.
+//
+// load_generator (--tcp HOST:PORT | --unix PATH) --queries FILE [--connections N] [--depth N] [--requests N]
+//
+// Every line of the queries file is sent as "FIND <line>" (lines that already start
+// with FIND, MATCH or PING are sent as is). Each connection keeps up to depth requests
+// in flight and the tool reports throughput and latency percentiles.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <netdb.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+using Clock = chrono::steady_clock;
+
+struct Options {
+    string tcp_address;
+    string unix_path;
+    string queries_path;
+    int connections = 4;
+    int depth = 16;
+    long long requests = 100000;
+};
+
+struct ConnectionReport {
+    vector<double> latencies_us;
+    long long errors = 0;
+    bool failed = false;
+};
+
+int Connect(const Options& options) {
+    if (!options.unix_path.empty()) {
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        strncpy(address.sun_path, options.unix_path.c_str(), sizeof(address.sun_path) - 1);
+        const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd >= 0 && connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0) {
+            return fd;
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    const size_t colon = options.tcp_address.rfind(':');
+    const string host = colon == string::npos ? "127.0.0.1"s : options.tcp_address.substr(0, colon);
+    const string port = colon == string::npos ? options.tcp_address : options.tcp_address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        return -1;
+    }
+    int fd = -1;
+    for (addrinfo* address = addresses; address != nullptr && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+        if (fd >= 0 && connect(fd, address->ai_addr, address->ai_addrlen) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    return fd;
+}
+
+bool SendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        const ssize_t size = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (size <= 0) {
+            return false;
+        }
+        sent += size;
+    }
+    return true;
+}
+
+void RunConnection(const Options& options, const vector<string>& requests, long long request_count, size_t first_request, ConnectionReport& report) {
+    const int fd = Connect(options);
+    if (fd < 0) {
+        report.failed = true;
+        return;
+    }
+    report.latencies_us.reserve(request_count);
+    deque<Clock::time_point> in_flight;
+    long long sent = 0;
+    string input;
+    char buffer[64 * 1024];
+
+    while (static_cast<long long>(report.latencies_us.size()) + report.errors < request_count) {
+        // Top the pipeline up with one write
+        string batch;
+        while (sent < request_count && static_cast<int>(in_flight.size()) < options.depth) {
+            batch += requests[(first_request + sent) % requests.size()];
+            in_flight.push_back(Clock::now());
+            ++sent;
+        }
+        if (!batch.empty() && !SendAll(fd, batch)) {
+            report.failed = true;
+            break;
+        }
+
+        const ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+        if (size <= 0) {
+            report.failed = true;
+            break;
+        }
+        input.append(buffer, size);
+        size_t line_begin = 0;
+        for (size_t line_end = input.find('\n'); line_end != string::npos; line_end = input.find('\n', line_begin)) {
+            const auto latency = Clock::now() - in_flight.front();
+            in_flight.pop_front();
+            if (input.compare(line_begin, 3, "ERR"s) == 0) {
+                ++report.errors;
+            }
+            else {
+                report.latencies_us.push_back(chrono::duration<double, micro>(latency).count());
+            }
+            line_begin = line_end + 1;
+        }
+        input.erase(0, line_begin);
+    }
+    close(fd);
+}
+
+double Percentile(const vector<double>& sorted_values, double fraction) {
+    if (sorted_values.empty()) {
+        return 0.0;
+    }
+    const size_t index = min(sorted_values.size() - 1, static_cast<size_t>(fraction * sorted_values.size()));
+    return sorted_values[index];
+}
+
+void PrintUsage() {
+    cerr << "Usage: load_generator (--tcp HOST:PORT | --unix PATH) --queries FILE [--connections N] [--depth N] [--requests N]"s << endl;
+}
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        const string option = argv[i];
+        const string value = argv[i + 1];
+        if (option == "--tcp"s) {
+            options.tcp_address = value;
+        }
+        else if (option == "--unix"s) {
+            options.unix_path = value;
+        }
+        else if (option == "--queries"s) {
+            options.queries_path = value;
+        }
+        else if (option == "--connections"s) {
+            options.connections = max(stoi(value), 1);
+        }
+        else if (option == "--depth"s) {
+            options.depth = max(stoi(value), 1);
+        }
+        else if (option == "--requests"s) {
+            options.requests = stoll(value);
+        }
+        else {
+            PrintUsage();
+            return 2;
+        }
+    }
+    if (argc % 2 == 0 || options.queries_path.empty() || (options.tcp_address.empty() && options.unix_path.empty())) {
+        PrintUsage();
+        return 2;
+    }
+
+    vector<string> requests;
+    ifstream in(options.queries_path);
+    string line;
+    while (getline(in, line)) {
+        if (line.empty()) {
+            continue;
+        }
+        const bool is_command = line.rfind("FIND "s, 0) == 0 || line.rfind("MATCH "s, 0) == 0 || line == "PING"s;
+        requests.push_back((is_command ? line : "FIND "s + line) + '\n');
+    }
+    if (requests.empty()) {
+        cerr << "No queries in "s << options.queries_path << endl;
+        return 1;
+    }
+
+    vector<ConnectionReport> reports(options.connections);
+    vector<thread> threads;
+    const auto start = Clock::now();
+    for (int i = 0; i < options.connections; ++i) {
+        const long long share = options.requests / options.connections + (i < options.requests % options.connections ? 1 : 0);
+        threads.emplace_back(RunConnection, cref(options), cref(requests), share, static_cast<size_t>(i) * 7919, ref(reports[i]));
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    const double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    vector<double> latencies;
+    long long errors = 0;
+    int failed_connections = 0;
+    for (const ConnectionReport& report : reports) {
+        latencies.insert(latencies.end(), report.latencies_us.begin(), report.latencies_us.end());
+        errors += report.errors;
+        failed_connections += report.failed ? 1 : 0;
+    }
+    sort(latencies.begin(), latencies.end());
+
+    cout << "requests: "s << latencies.size() + errors << " ("s << errors << " errors)"s << endl;
+    cout << "time: "s << seconds << " s, throughput: "s << (latencies.size() + errors) / seconds << " req/s"s << endl;
+    cout << "latency us: p50 "s << Percentile(latencies, 0.50) << ", p90 "s << Percentile(latencies, 0.90)
+        << ", p99 "s << Percentile(latencies, 0.99) << ", max "s << (latencies.empty() ? 0.0 : latencies.back()) << endl;
+    if (failed_connections > 0) {
+        cout << "failed connections: "s << failed_connections << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,4 @@
 #include <vector>
-#include <execution>
 #include <string>
 #include "document.h"
 #include "search_server.h"
@@ -7,28 +6,39 @@
 
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
-    const std::vector<std::string> queries)
+    const std::vector<std::string> queries,
+    LimitedThreadPool thread_pool)
 {
-    std::vector<std::vector<Document>> result(queries.size());
-    std::transform(std::execution::par, queries.begin(), queries.end(), result.begin(), [&search_server](const std::string str) {
-        return search_server.FindTopDocuments(str);
-        });
-    return result;
+    return search_server.FindTopDocumentsBatch(queries, thread_pool);
 }
 
 std::vector<Document> ProcessQueriesJoined(
     const SearchServer& search_server,
-    const std::vector<std::string> queries)
+    const std::vector<std::string> queries,
+    LimitedThreadPool thread_pool)
 {
-    std::vector<Document> result;
-    std::vector<std::vector<Document>> ProcessQueriesLoc = ProcessQueries(search_server, queries);
-    size_t size = 0;
+    std::vector<SearchHit> hits;
+    ProcessQueriesJoined(search_server, queries, hits, thread_pool);
+    return std::vector<Document>(hits.begin(), hits.end());
+}
 
-    for (std::vector<Document>& tmpDocs : ProcessQueriesLoc)
-        size += tmpDocs.size();
-    result.reserve(size);
-    for (std::vector<Document>& tmpDocs : ProcessQueriesLoc)
-        result.insert(result.end(), tmpDocs.begin(), tmpDocs.end());
+void ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    std::vector<SearchHit>& hits,
+    std::vector<size_t>& hit_offsets,
+    LimitedThreadPool thread_pool)
+{
+    search_server.FindTopDocumentsBatch(queries, hits, hit_offsets, thread_pool);
+}
 
-    return (result);
+void ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    std::vector<SearchHit>& hits,
+    LimitedThreadPool thread_pool)
+{
+    // The batch already lays the hits out query after query
+    std::vector<size_t> hit_offsets;
+    search_server.FindTopDocumentsBatch(queries, hits, hit_offsets, thread_pool);
 }
\ No newline at end of file
@@ -6,7 +6,23 @@
 
 std::vector<std::vector<Document>> ProcessQueries(
     const SearchServer& search_server,
-    const std::vector<std::string> queries);
+    const std::vector<std::string> queries,
+    LimitedThreadPool thread_pool = ThreadPool::GetDefault());
 std::vector<Document> ProcessQueriesJoined(
     const SearchServer& search_server,
-    const std::vector<std::string> queries);
\ No newline at end of file
+    const std::vector<std::string> queries,
+    LimitedThreadPool thread_pool = ThreadPool::GetDefault());
+
+// Allocation-free variants: hits (and hit_offsets) are overwritten and their storage reused,
+// see SearchServer::FindTopDocumentsBatch
+void ProcessQueries(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    std::vector<SearchHit>& hits,
+    std::vector<size_t>& hit_offsets,
+    LimitedThreadPool thread_pool = ThreadPool::GetDefault());
+void ProcessQueriesJoined(
+    const SearchServer& search_server,
+    const std::vector<std::string>& queries,
+    std::vector<SearchHit>& hits,
+    LimitedThreadPool thread_pool = ThreadPool::GetDefault());
\ No newline at end of file
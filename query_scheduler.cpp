@@ -0,0 +1,97 @@
+#include "query_scheduler.h"
+
+using namespace std;
+
+QueryScheduler::QueryScheduler(const SearchServer& search_server, chrono::microseconds batch_window, size_t max_batch_size,
+    LimitedThreadPool thread_pool, BatchFunction find_top_documents_batch)
+    : search_server_(search_server)
+    , find_top_documents_batch_(find_top_documents_batch)
+    , batch_window_(batch_window)
+    , max_batch_size_(max(max_batch_size, size_t(1)))
+    , thread_pool_(thread_pool)
+    , batches_(thread_pool.GetThreadPool())
+    , worker_([this] { Run(); })
+{
+}
+
+QueryScheduler::~QueryScheduler() {
+    {
+        lock_guard guard(mutex_);
+        stopping_ = true;
+    }
+    has_work_.notify_one();
+    worker_.join();
+    // batches_ waits for the batches still being evaluated when it's destroyed
+}
+
+future<vector<Document>> QueryScheduler::FindTopDocumentsAsync(string raw_query) {
+    PendingQuery query{ move(raw_query), {} };
+    auto result = query.result.get_future();
+    bool is_first = false;
+    bool is_full = false;
+    {
+        lock_guard guard(mutex_);
+        pending_.push_back(move(query));
+        is_first = pending_.size() == 1;
+        is_full = pending_.size() >= max_batch_size_;
+    }
+    // The worker only cares about the start of a window and about a full batch
+    if (is_first || is_full) {
+        has_work_.notify_one();
+    }
+    return result;
+}
+
+void QueryScheduler::Run() {
+    unique_lock lock(mutex_);
+    while (true) {
+        has_work_.wait(lock, [this] { return stopping_ || !pending_.empty(); });
+        if (pending_.empty()) {
+            return;
+        }
+        const auto deadline = chrono::steady_clock::now() + batch_window_;
+        has_work_.wait_until(lock, deadline, [this] {
+            return stopping_ || pending_.size() >= max_batch_size_;
+        });
+
+        // Shared because the pool takes copyable tasks and promises can only be moved
+        auto batch = make_shared<vector<PendingQuery>>(move(pending_));
+        pending_.clear();
+        lock.unlock();
+        batches_.Run([this, batch] { ExecuteBatch(*batch); });
+        lock.lock();
+    }
+}
+
+void QueryScheduler::ExecuteBatch(vector<PendingQuery>& batch) const {
+    vector<string> queries;
+    queries.reserve(batch.size());
+    for (const PendingQuery& query : batch) {
+        queries.push_back(query.raw_query);
+    }
+
+    vector<SearchHit> hits;
+    vector<size_t> hit_offsets;
+    try {
+        find_top_documents_batch_(search_server_, queries, hits, hit_offsets, thread_pool_);
+    }
+    catch (...) {
+        // One malformed query must not fail its neighbours
+        thread_pool_.ParallelFor(batch.size(), [&](size_t i) {
+            PendingQuery& query = batch[i];
+            vector<SearchHit> query_hits;
+            vector<size_t> query_hit_offsets;
+            try {
+                find_top_documents_batch_(search_server_, { query.raw_query }, query_hits, query_hit_offsets, thread_pool_);
+                query.result.set_value(vector<Document>(query_hits.begin(), query_hits.end()));
+            }
+            catch (...) {
+                query.result.set_exception(current_exception());
+            }
+            });
+        return;
+    }
+    for (size_t i = 0; i < batch.size(); ++i) {
+        batch[i].result.set_value(vector<Document>(hits.begin() + hit_offsets[i], hits.begin() + hit_offsets[i + 1]));
+    }
+}
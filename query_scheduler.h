@@ -0,0 +1,83 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "document.h"
+#include "search_server.h"
+#include "thread_pool.h"
+
+// Collects concurrent FindTopDocuments requests for a short window and evaluates
+// them as one FindTopDocumentsBatch call, so terms shared by the queries are scanned once.
+// The batches are evaluated on thread_pool, each with at most its concurrency limit of threads;
+// the scheduler's own thread only forms them, so a new batch starts collecting while
+// the previous ones are still being evaluated.
+// A batch sees the server as it was when the batch started; changes made meanwhile wait for it.
+class QueryScheduler {
+public:
+    // scoring_model only picks the ranking, e.g. Bm25Scoring<>{}; the results are those of
+    // SearchServer::FindTopDocuments<ScoringModel>(raw_query)
+    template <typename ScoringModel = TfIdfScoring>
+    explicit QueryScheduler(const SearchServer& search_server,
+        std::chrono::microseconds batch_window = std::chrono::microseconds(200),
+        size_t max_batch_size = 256,
+        LimitedThreadPool thread_pool = ThreadPool::GetDefault(),
+        ScoringModel scoring_model = {});
+    QueryScheduler(const QueryScheduler&) = delete;
+    QueryScheduler& operator=(const QueryScheduler&) = delete;
+    // Finishes every request already submitted
+    ~QueryScheduler();
+
+    // An invalid query sets the exception
+    std::future<std::vector<Document>> FindTopDocumentsAsync(std::string raw_query);
+
+private:
+    struct PendingQuery {
+        std::string raw_query;
+        std::promise<std::vector<Document>> result;
+    };
+    using BatchFunction = void (*)(const SearchServer& search_server, const std::vector<std::string>& raw_queries,
+        std::vector<SearchHit>& hits, std::vector<size_t>& hit_offsets, LimitedThreadPool thread_pool);
+
+    QueryScheduler(const SearchServer& search_server, std::chrono::microseconds batch_window, size_t max_batch_size,
+        LimitedThreadPool thread_pool, BatchFunction find_top_documents_batch);
+
+    const SearchServer& search_server_;
+    const BatchFunction find_top_documents_batch_;
+    const std::chrono::microseconds batch_window_;
+    const size_t max_batch_size_;
+    const LimitedThreadPool thread_pool_;
+
+    std::mutex mutex_;
+    std::condition_variable has_work_;
+    std::vector<PendingQuery> pending_;
+    bool stopping_ = false;
+    // Batches handed to the pool; only the worker starts them
+    TaskGroup batches_;
+    std::thread worker_;
+
+    void Run();
+    void ExecuteBatch(std::vector<PendingQuery>& batch) const;
+
+    template <typename ScoringModel>
+    static void FindTopDocumentsBatch(const SearchServer& search_server, const std::vector<std::string>& raw_queries,
+        std::vector<SearchHit>& hits, std::vector<size_t>& hit_offsets, LimitedThreadPool thread_pool);
+};
+
+template <typename ScoringModel>
+QueryScheduler::QueryScheduler(const SearchServer& search_server, std::chrono::microseconds batch_window, size_t max_batch_size,
+    LimitedThreadPool thread_pool, ScoringModel /*scoring_model*/)
+    : QueryScheduler(search_server, batch_window, max_batch_size, thread_pool, &FindTopDocumentsBatch<ScoringModel>)
+{
+}
+
+template <typename ScoringModel>
+void QueryScheduler::FindTopDocumentsBatch(const SearchServer& search_server, const std::vector<std::string>& raw_queries,
+    std::vector<SearchHit>& hits, std::vector<size_t>& hit_offsets, LimitedThreadPool thread_pool) {
+    search_server.FindTopDocumentsBatch<ScoringModel>(raw_queries, hits, hit_offsets, thread_pool);
+}
@@ -0,0 +1,445 @@
+#include "query_server.h"
+
+#include <arpa/inet.h>
+#include <array>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sstream>
+#include <stdexcept>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+namespace {
+// epoll_event.data.u64 tags: connections use ids below LISTENER_FLAG
+const uint64_t WAKE_ID = ~uint64_t(0);
+const uint64_t LISTENER_FLAG = uint64_t(1) << 62;
+
+const size_t READ_CHUNK_SIZE = 64 * 1024;
+const size_t MAX_REQUEST_LENGTH = 64 * 1024;
+// Requests of one connection that may be queued or running at the same time
+const uint64_t MAX_PIPELINE_DEPTH = 1024;
+// Responses a connection may have waiting for the client to read them
+const size_t MAX_PENDING_OUTPUT = 1024 * 1024;
+
+[[noreturn]] void ThrowSystemError(const string& what) {
+    throw runtime_error(what + ": "s + strerror(errno));
+}
+
+void AppendNumber(string& out, int value) {
+    char buffer[16];
+    const auto result = to_chars(begin(buffer), end(buffer), value);
+    out.append(buffer, result.ptr);
+}
+
+void AppendNumber(string& out, double value) {
+    char buffer[32];
+    const auto result = to_chars(begin(buffer), end(buffer), value, chars_format::general, 6);
+    out.append(buffer, result.ptr);
+}
+}
+
+QueryServer::QueryServer(const SearchServer& search_server, LimitedThreadPool thread_pool)
+    : search_server_(search_server)
+    , max_concurrency_(thread_pool.GetMaxConcurrency())
+    , requests_(thread_pool.GetThreadPool())
+{
+    epoll_fd_ = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd_ < 0) {
+        ThrowSystemError("epoll_create1"s);
+    }
+    wake_fd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (wake_fd_ < 0) {
+        close(epoll_fd_);
+        ThrowSystemError("eventfd"s);
+    }
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = WAKE_ID;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, wake_fd_, &event);
+}
+
+QueryServer::~QueryServer() {
+    // Requests still running report back through wake_fd_
+    try {
+        requests_.Wait();
+    }
+    catch (...) {
+    }
+    for (auto& [id, connection] : connections_) {
+        close(connection.fd);
+    }
+    for (const int fd : listen_fds_) {
+        close(fd);
+    }
+    for (const string& path : unix_paths_) {
+        unlink(path.c_str());
+    }
+    close(wake_fd_);
+    close(epoll_fd_);
+}
+
+void QueryServer::ListenTcp(const string& host, uint16_t port) {
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    addrinfo* addresses = nullptr;
+    const string service = to_string(port);
+    const int error = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &addresses);
+    if (error != 0) {
+        throw runtime_error("Can't resolve "s + host + ": "s + gai_strerror(error));
+    }
+
+    int fd = -1;
+    for (addrinfo* address = addresses; address != nullptr && fd < 0; address = address->ai_next) {
+        fd = socket(address->ai_family, address->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, address->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        const int enable = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+        if (bind(fd, address->ai_addr, address->ai_addrlen) != 0 || listen(fd, SOMAXCONN) != 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (fd < 0) {
+        ThrowSystemError("Can't listen on "s + host + ":"s + service);
+    }
+    AddListener(fd);
+}
+
+void QueryServer::ListenUnix(const string& path) {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path)) {
+        throw runtime_error("Unix socket path is too long: "s + path);
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        ThrowSystemError("socket"s);
+    }
+    // A socket file left behind by a previous run would make bind fail
+    unlink(path.c_str());
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0) {
+        close(fd);
+        ThrowSystemError("Can't listen on "s + path);
+    }
+    unix_paths_.push_back(path);
+    AddListener(fd);
+}
+
+void QueryServer::AddListener(int fd) {
+    epoll_event event{};
+    event.events = EPOLLIN;
+    event.data.u64 = LISTENER_FLAG | static_cast<uint64_t>(fd);
+    if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+        close(fd);
+        ThrowSystemError("epoll_ctl"s);
+    }
+    listen_fds_.push_back(fd);
+}
+
+void QueryServer::Run() {
+    array<epoll_event, 256> events;
+    while (!stopping_) {
+        const int count = epoll_wait(epoll_fd_, events.data(), static_cast<int>(events.size()), -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ThrowSystemError("epoll_wait"s);
+        }
+        for (int i = 0; i < count; ++i) {
+            const uint64_t id = events[i].data.u64;
+            if (id == WAKE_ID) {
+                uint64_t counter = 0;
+                [[maybe_unused]] const auto _ = read(wake_fd_, &counter, sizeof(counter));
+                DrainCompletions();
+            }
+            else if (id & LISTENER_FLAG) {
+                AcceptClients(static_cast<int>(id & ~LISTENER_FLAG));
+            }
+            else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                // Reported even with an empty interest mask; nothing can be sent back any more
+                if (connections_.count(id)) {
+                    CloseConnection(id);
+                }
+            }
+            else {
+                if (events[i].events & EPOLLIN) {
+                    ReadFromClient(id);
+                }
+                if ((events[i].events & EPOLLOUT) && connections_.count(id)) {
+                    WriteToClient(id);
+                }
+            }
+        }
+    }
+}
+
+void QueryServer::Stop() {
+    stopping_ = true;
+    Wake();
+}
+
+void QueryServer::Wake() {
+    const uint64_t one = 1;
+    [[maybe_unused]] const auto _ = write(wake_fd_, &one, sizeof(one));
+}
+
+void QueryServer::AcceptClients(int listen_fd) {
+    while (true) {
+        const int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            // EAGAIN: backlog is empty; anything else only concerns that one client
+            return;
+        }
+        const int enable = 1;
+        // Fails harmlessly on Unix sockets
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+
+        const uint64_t id = next_connection_id_++;
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.u64 = id;
+        if (epoll_ctl(epoll_fd_, EPOLL_CTL_ADD, fd, &event) != 0) {
+            close(fd);
+            continue;
+        }
+        connections_[id].fd = fd;
+    }
+}
+
+void QueryServer::ReadFromClient(uint64_t connection_id) {
+    const auto it = connections_.find(connection_id);
+    if (it == connections_.end()) {
+        return;
+    }
+    Connection& connection = it->second;
+    char buffer[READ_CHUNK_SIZE];
+    while (!connection.reading_paused) {
+        const ssize_t size = read(connection.fd, buffer, sizeof(buffer));
+        if (size > 0) {
+            connection.input.append(buffer, size);
+            DispatchRequests(connection_id, connection);
+            // Unless reading is paused, every complete line has been dispatched and the rest is one unfinished request
+            if (!connection.reading_paused && connection.input.size() > MAX_REQUEST_LENGTH) {
+                CloseConnection(connection_id);
+                return;
+            }
+            continue;
+        }
+        if (size == 0) {
+            connection.peer_closed = true;
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            CloseConnection(connection_id);
+            return;
+        }
+        break;
+    }
+    UpdateInterest(connection_id, connection);
+    CloseIfDone(connection_id);
+}
+
+void QueryServer::DispatchRequests(uint64_t connection_id, Connection& connection) {
+    size_t line_begin = 0;
+    while (true) {
+        if (connection.next_request - connection.next_response >= MAX_PIPELINE_DEPTH
+            || connection.output.size() >= MAX_PENDING_OUTPUT) {
+            // Stop reading until the requests in flight finish and the client has read their responses
+            connection.reading_paused = true;
+            break;
+        }
+        connection.reading_paused = false;
+        const size_t line_end = connection.input.find('\n', line_begin);
+        if (line_end == string::npos) {
+            break;
+        }
+        SubmitRequest({ connection_id, connection.next_request++, connection.input.substr(line_begin, line_end - line_begin) });
+        line_begin = line_end + 1;
+    }
+    connection.input.erase(0, line_begin);
+}
+
+void QueryServer::SubmitRequest(Request request) {
+    {
+        lock_guard guard(requests_mutex_);
+        if (max_concurrency_ > 0 && running_requests_ >= max_concurrency_) {
+            waiting_requests_.push_back(move(request));
+            return;
+        }
+        ++running_requests_;
+    }
+    requests_.Run([this, request = move(request)]() mutable { ServeRequests(move(request)); });
+}
+
+void QueryServer::ServeRequests(Request request) {
+    while (true) {
+        string response = HandleRequest(search_server_, request.line);
+        {
+            lock_guard guard(completions_mutex_);
+            completions_.push_back({ request.connection_id, request.sequence, move(response) });
+        }
+        Wake();
+
+        lock_guard guard(requests_mutex_);
+        if (waiting_requests_.empty()) {
+            --running_requests_;
+            return;
+        }
+        request = move(waiting_requests_.front());
+        waiting_requests_.pop_front();
+    }
+}
+
+void QueryServer::DrainCompletions() {
+    vector<Completion> completions;
+    {
+        lock_guard guard(completions_mutex_);
+        completions.swap(completions_);
+    }
+    vector<uint64_t> touched;
+    for (Completion& completion : completions) {
+        const auto it = connections_.find(completion.connection_id);
+        if (it == connections_.end()) {
+            // The client went away while its request was running
+            continue;
+        }
+        it->second.ready_responses.emplace(completion.sequence, move(completion.response));
+        touched.push_back(completion.connection_id);
+    }
+    sort(touched.begin(), touched.end());
+    touched.erase(unique(touched.begin(), touched.end()), touched.end());
+
+    for (const uint64_t connection_id : touched) {
+        Connection& connection = connections_.at(connection_id);
+        auto& ready = connection.ready_responses;
+        while (!ready.empty() && ready.begin()->first == connection.next_response) {
+            connection.output += ready.begin()->second;
+            connection.output += '\n';
+            ready.erase(ready.begin());
+            ++connection.next_response;
+        }
+        WriteToClient(connection_id);
+    }
+}
+
+void QueryServer::WriteToClient(uint64_t connection_id) {
+    Connection& connection = connections_.at(connection_id);
+    size_t written = 0;
+    while (written < connection.output.size()) {
+        const ssize_t size = send(connection.fd, connection.output.data() + written, connection.output.size() - written, MSG_NOSIGNAL);
+        if (size > 0) {
+            written += size;
+            continue;
+        }
+        if (size < 0 && errno == EINTR) {
+            continue;
+        }
+        if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        }
+        CloseConnection(connection_id);
+        return;
+    }
+    connection.output.erase(0, written);
+    connection.wants_write = !connection.output.empty();
+    if (connection.reading_paused) {
+        DispatchRequests(connection_id, connection);
+    }
+    UpdateInterest(connection_id, connection);
+    CloseIfDone(connection_id);
+}
+
+void QueryServer::UpdateInterest(uint64_t connection_id, Connection& connection) {
+    epoll_event event{};
+    if (!connection.reading_paused && !connection.peer_closed) {
+        event.events |= EPOLLIN;
+    }
+    if (connection.wants_write) {
+        event.events |= EPOLLOUT;
+    }
+    event.data.u64 = connection_id;
+    epoll_ctl(epoll_fd_, EPOLL_CTL_MOD, connection.fd, &event);
+}
+
+void QueryServer::CloseIfDone(uint64_t connection_id) {
+    const auto it = connections_.find(connection_id);
+    if (it == connections_.end()) {
+        return;
+    }
+    const Connection& connection = it->second;
+    if (connection.peer_closed && connection.next_response == connection.next_request && connection.output.empty()) {
+        CloseConnection(connection_id);
+    }
+}
+
+void QueryServer::CloseConnection(uint64_t connection_id) {
+    const auto it = connections_.find(connection_id);
+    epoll_ctl(epoll_fd_, EPOLL_CTL_DEL, it->second.fd, nullptr);
+    close(it->second.fd);
+    connections_.erase(it);
+}
+
+string QueryServer::HandleRequest(const SearchServer& search_server, string_view request) {
+    if (!request.empty() && request.back() == '\r') {
+        request.remove_suffix(1);
+    }
+    const size_t space = request.find(' ');
+    const string_view command = request.substr(0, space);
+    const string_view argument = space == string_view::npos ? string_view() : request.substr(space + 1);
+
+    try {
+        if (command == "PING"sv) {
+            return "OK"s;
+        }
+        if (command == "FIND"sv) {
+            array<SearchHit, MAX_RESULT_DOCUMENT_COUNT> hits;
+            const size_t hit_count = search_server.FindTopDocuments(argument, DocumentStatus::ACTUAL, hits.data(), hits.size());
+            string response = "OK "s;
+            AppendNumber(response, static_cast<int>(hit_count));
+            for (size_t i = 0; i < hit_count; ++i) {
+                response += ' ';
+                AppendNumber(response, hits[i].id);
+                response += ' ';
+                AppendNumber(response, hits[i].relevance);
+                response += ' ';
+                AppendNumber(response, hits[i].rating);
+            }
+            return response;
+        }
+        if (command == "MATCH"sv) {
+            const size_t id_end = min(argument.find(' '), argument.size());
+            int document_id = 0;
+            const auto parsed = from_chars(argument.data(), argument.data() + id_end, document_id);
+            if (parsed.ec != errc() || parsed.ptr != argument.data() + id_end) {
+                return "ERR invalid document id"s;
+            }
+            const auto [words, status] = search_server.MatchDocument(argument.substr(min(id_end + 1, argument.size())), document_id);
+            ostringstream response;
+            response << "OK "s << status;
+            for (const string_view word : words) {
+                response << ' ' << word;
+            }
+            return response.str();
+        }
+        return "ERR unknown command"s;
+    }
+    catch (const exception& e) {
+        return "ERR "s + e.what();
+    }
+}
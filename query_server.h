@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "search_server.h"
+#include "thread_pool.h"
+
+// Network frontend for a SearchServer (Linux: epoll, eventfd). The server may be changed
+// while it serves; every request sees it either before or after a change.
+//
+// Line protocol, requests may be pipelined and responses come back in request order:
+//   FIND <query>              -> OK <count>[ <id> <relevance> <rating>]...
+//   MATCH <document_id> <query> -> OK <status>[ <word>]...
+//   PING                      -> OK
+// Any failure is reported as ERR <message>; the connection stays open.
+// A connection with 1024 requests in flight or 1 MiB of responses its client hasn't
+// read yet is not read from until that drains.
+// Requests are evaluated on thread_pool, which may be shared with other work; with a
+// concurrency limit, at most that many requests are evaluated at a time and the rest wait.
+class QueryServer {
+public:
+    QueryServer(const SearchServer& search_server, LimitedThreadPool thread_pool);
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+    ~QueryServer();
+
+    // Both may be called several times before Run(); throw std::runtime_error on failure
+    void ListenTcp(const std::string& host, uint16_t port);
+    void ListenUnix(const std::string& path);
+
+    // Serves clients until Stop() is called
+    void Run();
+    // Safe to call from another thread or from a signal handler
+    void Stop();
+
+    // Builds the response line (without '\n') for one request line
+    static std::string HandleRequest(const SearchServer& search_server, std::string_view request);
+
+private:
+    struct Connection {
+        int fd = -1;
+        std::string input;
+        std::string output;
+        uint64_t next_request = 0;
+        uint64_t next_response = 0;
+        std::map<uint64_t, std::string> ready_responses;
+        bool peer_closed = false;
+        bool wants_write = false;
+        bool reading_paused = false;
+    };
+    struct Request {
+        uint64_t connection_id;
+        uint64_t sequence;
+        std::string line;
+    };
+    struct Completion {
+        uint64_t connection_id;
+        uint64_t sequence;
+        std::string response;
+    };
+
+    const SearchServer& search_server_;
+    int epoll_fd_ = -1;
+    int wake_fd_ = -1;
+    std::atomic<bool> stopping_ = false;
+    std::vector<int> listen_fds_;
+    std::vector<std::string> unix_paths_;
+    uint64_t next_connection_id_ = 0;
+    std::unordered_map<uint64_t, Connection> connections_;
+
+    // Requests go to the pool, responses come back to the event loop through completions_.
+    // A task serves waiting requests until none are left, so running_requests_ tasks are in flight
+    const size_t max_concurrency_;
+    std::mutex requests_mutex_;
+    std::deque<Request> waiting_requests_;
+    size_t running_requests_ = 0;
+    TaskGroup requests_;
+    std::mutex completions_mutex_;
+    std::vector<Completion> completions_;
+
+    void AddListener(int fd);
+    void AcceptClients(int listen_fd);
+    void ReadFromClient(uint64_t connection_id);
+    void DispatchRequests(uint64_t connection_id, Connection& connection);
+    void SubmitRequest(Request request);
+    void ServeRequests(Request request);
+    void DrainCompletions();
+    void WriteToClient(uint64_t connection_id);
+    void UpdateInterest(uint64_t connection_id, Connection& connection);
+    void CloseIfDone(uint64_t connection_id);
+    void CloseConnection(uint64_t connection_id);
+    void Wake();
+};
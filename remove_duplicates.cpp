@@ -1,6 +1,9 @@
 #include "remove_duplicates.h"
 
 #include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
 #include <set>
 #include <iostream>
 #include "search_server.h"
@@ -12,29 +15,170 @@ std::set<std::string_view> wordSplit(int doc_ID, const SearchServer& search_serv
     return Words;
 }
 
-/// не замечание, но можете поработать еще над данной функцией, улучшить, если не получится, то можете оставить как есть.
-/// в таком виде у вас сложность будет выше чем заявлено в задании
-/// для эттого предлагаю:
-/// 1. поменять тип контейнера remove_ID, у вас есть поиск по данному контейнеру, к примеру, у std::set лучше характиристика поиска, и он уже отсортированный, т.е. можно избавиться от сортировки ниже
-/// 2. у вас 2-йно проход по контейнеру и получается, что сравниваете словарь слов каждый с каждым, при этом этот словарь каждый раз создаете.
-///    можно завести дополнительный контейнер (std::set или std::map) для словарей которые уже были
-///    получается один проход по search_server с проверкой словаря в этом контейнере, если его там нет, то добавляем, если есть, то ID для удаления
-
-/// Как реализовать с одним циклом не придумал, 
 void RemoveDuplicates(SearchServer& search_server) {
+    // Word views point into the server's dictionary, so a document's word set is built without copying strings
+    std::set<std::set<std::string_view>> seen_word_sets;
     std::set<int> remove_ID;
 
-    for (auto iterator_first = search_server.begin(); iterator_first != search_server.end(); ++iterator_first)
-        if(remove_ID.count(*iterator_first)==0) {			
-            std::set<std::string>   words_first = wordSplit(*iterator_first, search_server);	
-            for (auto iterator_second = std::next(iterator_first); iterator_second != search_server.end(); ++iterator_second)
-                if (remove_ID.count(*iterator_second) == 0) {	
-                    std::set<std::string>  words_second = wordSplit(*iterator_second, search_server);
-                    if (words_first == words_second) remove_ID.insert(*iterator_second);
-            }
-     }
+    for (const int document_id : search_server)
+        if (!seen_word_sets.insert(wordSplit(document_id, search_server)).second)
+            remove_ID.insert(document_id);
     for (int delet_ID : remove_ID) {
         search_server.RemoveDocument(delet_ID);
         std::cout << "Found duplicate document id " << delet_ID << std::endl;
     }
 }
+
+namespace {
+uint64_t MixHash(uint64_t value) {
+    // splitmix64 finaliser
+    value += 0x9e3779b97f4a7c15ULL;
+    value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    value = (value ^ (value >> 27)) * 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// Rows per band whose LSH S-curve midpoint (1/bands)^(1/rows) lies closest to the threshold
+// from below, so that pairs at the threshold are still likely to share a bucket
+int ChooseRowsPerBand(int signature_size, double threshold) {
+    int best_rows = 1;
+    for (int rows = 1; rows <= signature_size; ++rows) {
+        const int bands = signature_size / rows;
+        if (std::pow(1.0 / bands, 1.0 / rows) <= threshold) {
+            best_rows = rows;
+        }
+    }
+    return best_rows;
+}
+
+// Sorted keys of the document's distinct words, for exact set comparisons. Equal words share one
+// dictionary entry, so a word's address identifies it
+void GetWordKeys(const SearchServer& search_server, int document_id, std::vector<const char*>& keys) {
+    keys.clear();
+    for (const auto [word, _] : search_server.GetWordFrequencies(document_id)) {
+        keys.push_back(word.data());
+    }
+    std::sort(keys.begin(), keys.end(), std::less<const char*>());
+}
+
+double ComputeJaccardSimilarity(const std::vector<const char*>& lhs, const std::vector<const char*>& rhs) {
+    if (lhs.empty() && rhs.empty()) {
+        return 1.0;
+    }
+    size_t common = 0;
+    for (size_t i = 0, j = 0; i < lhs.size() && j < rhs.size();) {
+        if (std::less<const char*>()(lhs[i], rhs[j])) {
+            ++i;
+        }
+        else if (std::less<const char*>()(rhs[j], lhs[i])) {
+            ++j;
+        }
+        else {
+            ++common;
+            ++i;
+            ++j;
+        }
+    }
+    return static_cast<double>(common) / (lhs.size() + rhs.size() - common);
+}
+}
+
+std::vector<std::vector<int>> FindNearDuplicates(const SearchServer& search_server, const NearDuplicateOptions& options, LimitedThreadPool thread_pool) {
+    const std::vector<int> document_ids(search_server.begin(), search_server.end());
+    const size_t document_count = document_ids.size();
+    const size_t signature_size = static_cast<size_t>(std::max(options.signature_size, 1));
+    const size_t rows = static_cast<size_t>(ChooseRowsPerBand(static_cast<int>(signature_size), options.similarity_threshold));
+    const size_t bands = signature_size / rows;
+
+    std::vector<uint64_t> hash_seeds(signature_size);
+    for (size_t i = 0; i < signature_size; ++i) {
+        hash_seeds[i] = MixHash(options.seed + i);
+    }
+
+    // Only the band hashes are kept: band_buckets[band][document_index] is (hash of the band's rows, document_index).
+    // A document's signature lives just long enough to hash its bands, so memory is O(documents * bands)
+    std::vector<std::vector<std::pair<uint64_t, size_t>>> band_buckets(bands, std::vector<std::pair<uint64_t, size_t>>(document_count));
+    const size_t documents_per_task = 256;
+    thread_pool.ParallelFor((document_count + documents_per_task - 1) / documents_per_task, [&](size_t task) {
+        std::vector<uint64_t> signature(signature_size);
+        const size_t last_document = std::min(document_count, (task + 1) * documents_per_task);
+        for (size_t document_index = task * documents_per_task; document_index < last_document; ++document_index) {
+            std::fill(signature.begin(), signature.end(), std::numeric_limits<uint64_t>::max());
+            for (const auto [word, _] : search_server.GetWordFrequencies(document_ids[document_index])) {
+                const uint64_t word_hash = std::hash<std::string_view>{}(word);
+                for (size_t i = 0; i < signature_size; ++i) {
+                    signature[i] = std::min(signature[i], MixHash(word_hash ^ hash_seeds[i]));
+                }
+            }
+            for (size_t band = 0; band < bands; ++band) {
+                uint64_t bucket = band;
+                for (size_t i = band * rows; i < (band + 1) * rows; ++i) {
+                    bucket = MixHash(bucket ^ signature[i]);
+                }
+                band_buckets[band][document_index] = { bucket, document_index };
+            }
+        }
+        });
+    thread_pool.ParallelFor(bands, [&](size_t band) {
+        std::sort(band_buckets[band].begin(), band_buckets[band].end());
+        });
+
+    // Documents that agree on every row of some band share a bucket and become candidates. Clusters are
+    // stars: a document joins the first leader it is verified similar to and stays there, and a leader
+    // never joins anyone, so similarity is not chained through a member. A candidate is checked against
+    // at most max_leaders earlier members of its bucket that are not members themselves, so a bucket
+    // of k documents costs O(k) comparisons
+    const size_t max_leaders = static_cast<size_t>(std::max(options.max_leaders, 1));
+    const size_t NO_LEADER = document_count;
+    std::vector<size_t> leader_of(document_count, NO_LEADER);
+    std::vector<bool> is_leader(document_count);
+    std::vector<size_t> leaders;
+    std::vector<std::vector<const char*>> leader_keys(max_leaders);
+    std::vector<const char*> keys;
+    for (const auto& buckets : band_buckets) {
+        for (size_t first = 0; first < buckets.size();) {
+            size_t last = first + 1;
+            while (last < buckets.size() && buckets[last].first == buckets[first].first) {
+                ++last;
+            }
+            leaders.clear();
+            for (size_t i = first; i < last && last - first > 1; ++i) {
+                const size_t document_index = buckets[i].second;
+                if (leader_of[document_index] != NO_LEADER || (is_leader[document_index] && leaders.size() == max_leaders)) {
+                    continue;
+                }
+                GetWordKeys(search_server, document_ids[document_index], keys);
+                bool is_similar = false;
+                for (size_t leader = 0; leader < leaders.size() && !is_leader[document_index] && !is_similar; ++leader) {
+                    if (ComputeJaccardSimilarity(leader_keys[leader], keys) >= options.similarity_threshold) {
+                        leader_of[document_index] = leaders[leader];
+                        is_leader[leaders[leader]] = true;
+                        is_similar = true;
+                    }
+                }
+                if (!is_similar && leaders.size() < max_leaders) {
+                    leader_keys[leaders.size()].swap(keys);
+                    leaders.push_back(document_index);
+                }
+            }
+            first = last;
+        }
+    }
+
+    std::vector<std::vector<int>> result;
+    std::vector<size_t> cluster_of(document_count);
+    for (size_t document_index = 0; document_index < document_count; ++document_index) {
+        if (is_leader[document_index]) {
+            cluster_of[document_index] = result.size();
+            result.push_back({ document_ids[document_index] });
+        }
+    }
+    // Leaders precede their members in every bucket, so each leader's cluster exists by now and stays sorted by id
+    for (size_t document_index = 0; document_index < document_count; ++document_index) {
+        if (leader_of[document_index] != NO_LEADER) {
+            result[cluster_of[leader_of[document_index]]].push_back(document_ids[document_index]);
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
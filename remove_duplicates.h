@@ -1,5 +1,30 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
 #include "search_server.h"
+#include "thread_pool.h"
 
-void RemoveDuplicates(SearchServer& search_server);
\ No newline at end of file
+void RemoveDuplicates(SearchServer& search_server);
+
+struct NearDuplicateOptions {
+    // Minimal Jaccard similarity of two documents' word sets
+    double similarity_threshold = 0.8;
+    // MinHash signature length; more hashes make the LSH candidate selection sharper and cost proportionally more
+    int signature_size = 128;
+    uint64_t seed = 0x5eed;
+    // How many documents of one LSH bucket a candidate is compared with. Buckets are mostly tiny, so
+    // this only bounds the cost of a huge bucket at O(bucket size * max_leaders) comparisons; beyond
+    // the cap some pairs of a crowded bucket go unchecked unless they share another band
+    int max_leaders = 4;
+};
+
+// Groups documents that are near duplicates of each other. MinHash signatures are computed
+// in parallel from the forward index and reduced on the spot to LSH band hashes tuned to the threshold;
+// documents sharing a band bucket are compared exactly on their word sets. Clustering is not
+// transitive: every cluster is a leader, its smallest id, followed by the documents verified similar
+// to it, so two members may be less similar to each other than the threshold. A document belongs
+// to at most one cluster. Every cluster is sorted by id and has at least two documents; nothing is
+// removed, so the caller decides which document of a cluster to keep
+std::vector<std::vector<int>> FindNearDuplicates(const SearchServer& search_server, const NearDuplicateOptions& options = {},
+    LimitedThreadPool thread_pool = ThreadPool::GetDefault());
@@ -5,21 +5,23 @@
 #include "request_queue.h"
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentStatus status) {
     std::vector<Document> result = search_server_.FindTopDocuments(raw_query, status);
-    if (result.empty()) ++ZeroResult_;
-    if (requests_.size() == sec_in_day_) requests_.pop_front();
-    requests_.push_back({ raw_query,result });
+    RecordRequest(result.size());
     return result;
 }
 
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query) {
     std::vector<Document> result = search_server_.FindTopDocuments(raw_query);
-    if (result.empty()) ++ZeroResult_;
+    RecordRequest(result.size());
+    return result;
+}
+
+void RequestQueue::RecordRequest(size_t hit_count) {
+    if (hit_count == 0) ++ZeroResult_;
     if (requests_.size() == sec_in_day_) {
-        if (requests_.front().Result.empty()) --ZeroResult_;
+        if (requests_.front().hit_count == 0) --ZeroResult_;
         requests_.pop_front();
     }
-    requests_.push_back({ raw_query,result });
-    return result;
+    requests_.push_back({ hit_count });
 }
 
 int RequestQueue::GetNoResultRequests() const {
@@ -16,6 +16,10 @@ public:
 
     std::vector<Document> AddFindRequest(const std::string& raw_query);
 
+    // Returns the results in hits, reusing its storage, see SearchServer::FindTopDocuments
+    template <typename DocumentPredicate>
+    void AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate, std::vector<SearchHit>& hits);
+
     int GetNoResultRequests() const;
 
     std::vector<int>::iterator begin();
@@ -24,15 +28,17 @@ public:
 
     int GetDocumentId(int index) const;
 private:
+    // Only the number of hits is needed for the no-result statistics
     struct QueryResult {
-        std::string raw_query;
-        std::vector<Document> Result;
+        size_t hit_count;
     };
 
     std::deque<QueryResult> requests_;
     const static int sec_in_day_ = 1440;
     const SearchServer& search_server_;
     int ZeroResult_ = 0;
+
+    void RecordRequest(size_t hit_count);
 };
 /// Шаблоны не могут быть в cpp файле. Перенесите h-файл, разместите после описания класса.
 /// Так же есть вариант с отдельм файлом (к примеру в библиатеке boost используются расширение hpp, т.е. будет request_queue.hpp),
@@ -40,8 +46,12 @@ private:
 template <typename DocumentPredicate>
 std::vector<Document> RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate) {
     std::vector<Document> result = search_server_.FindTopDocuments(raw_query, document_predicate);
-    if (result.empty()) ++ZeroResult_;
-    if (requests_.size() == sec_in_day_) requests_.pop_front();
-    requests_.push_back({ raw_query,result });
+    RecordRequest(result.size());
     return result;
 }
+
+template <typename DocumentPredicate>
+void RequestQueue::AddFindRequest(const std::string& raw_query, DocumentPredicate document_predicate, std::vector<SearchHit>& hits) {
+    search_server_.FindTopDocuments(raw_query, document_predicate, hits);
+    RecordRequest(hits.size());
+}
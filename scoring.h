@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cmath>
+#include <type_traits>
+#include "document.h"
+
+// Scoring models for SearchServer::FindTopDocuments<ScoringModel>.
+// Score() gets the word's share of the document (term_freq), the word's IDF,
+// the document length in non-stop words and the average length over the index.
+// Models that ignore the length set uses_document_length = false.
+// MaxScore() bounds Score() for a word whose highest term_freq is max_term_freq
+// whatever the document length; searches skip documents that can't reach the top with it.
+
+struct TfIdfScoring {
+    static constexpr bool uses_document_length = false;
+
+    static double Score(double term_freq, double inverse_document_freq, int /*document_length*/, double /*average_document_length*/) {
+        return term_freq * inverse_document_freq;
+    }
+
+    static double MaxScore(double max_term_freq, double inverse_document_freq) {
+        return max_term_freq * inverse_document_freq;
+    }
+};
+
+// Okapi BM25. Template parameters are k1 and b multiplied by 100,
+// since floating point template parameters need C++20
+template <int K1Percent = 120, int BPercent = 75>
+struct Bm25Scoring {
+    static constexpr bool uses_document_length = true;
+    static constexpr double K1 = K1Percent / 100.0;
+    static constexpr double B = BPercent / 100.0;
+
+    static double Score(double term_freq, double inverse_document_freq, int document_length, double average_document_length) {
+        const double occurrences = term_freq * document_length;
+        const double length_norm = 1.0 - B + B * document_length / average_document_length;
+        return inverse_document_freq * occurrences * (K1 + 1.0) / (occurrences + K1 * length_norm);
+    }
+
+    // The term frequency part saturates below k1 + 1
+    static double MaxScore(double /*max_term_freq*/, double inverse_document_freq) {
+        return inverse_document_freq * (K1 + 1.0);
+    }
+};
+
+// TF-IDF rounded to 1/Levels steps, the way impact-ordered indexes store scores.
+// Documents whose impacts fall into the same step tie and are ordered by rating
+template <int Levels = 256>
+struct QuantizedImpactScoring {
+    static constexpr bool uses_document_length = false;
+    static constexpr double STEP = 1.0 / Levels;
+
+    static double Score(double term_freq, double inverse_document_freq, int /*document_length*/, double /*average_document_length*/) {
+        return std::round(term_freq * inverse_document_freq / STEP) * STEP;
+    }
+
+    static double MaxScore(double max_term_freq, double inverse_document_freq) {
+        return Score(max_term_freq, inverse_document_freq, 0, 0.0);
+    }
+};
+
+// Ready-made predicates for FindTopDocuments; any callable taking
+// (document_id, status, rating) gives the same results. These two are recognised at compile
+// time: they only read the document's attributes, so the search evaluates them for 64 documents
+// at a time into a bitmap and never scores a document they reject. Any other callable is
+// called once per candidate that can still reach the top results.
+
+struct StatusIs {
+    DocumentStatus status;
+
+    bool operator()(int /*document_id*/, DocumentStatus document_status, int /*rating*/) const {
+        return document_status == status;
+    }
+};
+
+struct RatingAtLeast {
+    int min_rating;
+
+    bool operator()(int /*document_id*/, DocumentStatus /*document_status*/, int rating) const {
+        return rating >= min_rating;
+    }
+};
+
+template <typename DocumentPredicate>
+inline constexpr bool is_attribute_predicate_v =
+    std::is_same_v<DocumentPredicate, StatusIs> || std::is_same_v<DocumentPredicate, RatingAtLeast>;
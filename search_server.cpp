@@ -1,9 +1,37 @@
 #include "search_server.h"
 
+#include <cassert>
 #include <cmath>
+#include <fstream>
+#include <numeric>
 
 using namespace std;
 
+namespace {
+// Approximate size of a red-black tree node header: colour plus parent, left and right links
+const size_t MAP_NODE_OVERHEAD = 4 * sizeof(void*);
+
+// First and last string of a snapshot file; the version changes with the layout
+const string SNAPSHOT_FORMAT = "search_server snapshot 1"s;
+const string SNAPSHOT_END = "end of snapshot"s;
+
+size_t EstimateStringBytes(const string& str) {
+    // Short strings live inside the std::string object itself
+    const char* object_begin = reinterpret_cast<const char*>(&str);
+    const bool is_inline = str.data() >= object_begin && str.data() < object_begin + sizeof(string);
+    return is_inline ? 0 : str.capacity() + 1;
+}
+
+template <typename Key, typename Value, typename Compare>
+size_t EstimateMapNodesBytes(const map<Key, Value, Compare>& container) {
+    return container.size() * (MAP_NODE_OVERHEAD + sizeof(typename map<Key, Value, Compare>::value_type));
+}
+}
+
+size_t IndexStats::GetTotalBytes() const {
+    return dictionary_bytes + inverted_index_bytes + forward_index_bytes + document_data_bytes;
+}
+
 SearchServer::SearchServer(const  string& stop_words_text)
     :SearchServer(MakeUniqueNonEmptyStrings(SplitIntoWords(stop_words_text)))
 {
@@ -11,80 +39,193 @@ SearchServer::SearchServer(const  string& stop_words_text)
 
 
 
+SearchServer::~SearchServer() {
+    {
+        lock_guard guard(segments_mutex_);
+        stopping_merges_ = true;
+    }
+    merges_changed_.notify_all();
+    if (merger_.joinable()) {
+        merger_.join();
+    }
+}
+
 void SearchServer::AddDocument(int document_id, const string_view document, DocumentStatus status,
     const vector<int>& ratings) {
-    if ((document_id < 0) || (documents_.count(document_id) > 0)) {
+    AddDocument(document_id, document, SplitIntoWordsNoStop(document), status, ratings);
+}
+
+void SearchServer::AddDocument(int document_id, string_view document, const vector<string_view>& words,
+    DocumentStatus status, const vector<int>& ratings) {
+    const unique_lock lock(index_mutex_);
+    if ((document_id < 0) || (document_ids_.count(document_id) > 0)) {
         throw invalid_argument("Invalid document_id"s);
     }
-    const auto words = SplitIntoWordsNoStop(document.data());
+    assert(words == SplitIntoWordsNoStop(document));
+    // Only words new to the dictionary are copied
+    if (write_ahead_log_) {
+        log_sequence_ = write_ahead_log_->LogAddDocument(document_id, document, status, ratings);
+    }
+
+    vector<int> term_ids;
+    term_ids.reserve(words.size());
+    for (const string_view word : words) {
+        auto term_it = word_to_term_id_.find(word);
+        if (term_it == word_to_term_id_.end()) {
+            term_it = word_to_term_id_.emplace(string(word), static_cast<int>(term_words_.size())).first;
+            term_words_.push_back(term_it->first);
+            term_document_counts_.push_back(0);
+        }
+        term_ids.push_back(term_it->second);
+    }
+    sort(term_ids.begin(), term_ids.end());
 
     const double inv_word_count = 1.0 / words.size();
-    for (const string word : words) {
-        word_to_document_freqs_[word][document_id] += inv_word_count;
-        document_to_word_freqs_[document_id][word] += inv_word_count;
+    vector<TermFrequency> term_freqs;
+    for (const int term_id : term_ids) {
+        if (term_freqs.empty() || term_freqs.back().term_id != term_id) {
+            term_freqs.push_back({ term_id, 0.0 });
+        }
+        term_freqs.back().term_freq += inv_word_count;
+    }
+    for (const TermFrequency& term_freq : term_freqs) {
+        ++term_document_counts_[term_freq.term_id];
     }
-    documents_.emplace(document_id, DocumentData{ ComputeAverageRating(ratings), status });
+
+    IndexSegment& segment = *GetSegments()->back();
+    segment.AddDocument({ document_id, ComputeAverageRating(ratings), status, static_cast<int>(words.size()) }, term_freqs);
+    total_word_count_ += words.size();
     document_ids_.insert(document_id);
+    if (segment.GetDocumentCount() >= segment_options_.mutable_segment_capacity) {
+        SealMutableSegment();
+    }
 }
 
 vector<Document> SearchServer::FindTopDocuments(const string_view raw_query, DocumentStatus status) const {
-    return FindTopDocuments(raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-        });
+    return FindTopDocuments(raw_query, StatusIs{ status });
 }
 
 vector<Document> SearchServer::FindTopDocuments(const string_view raw_query) const {
     return FindTopDocuments(raw_query, DocumentStatus::ACTUAL);
 }
 
-int SearchServer::GetDocumentCount() const {
-    return documents_.size();
+SearchServer::BatchPlan SearchServer::PlanBatch(const vector<string>& raw_queries) const {
+    // Parse every distinct query once, so repeated queries share all of the work
+    BatchPlan batch;
+    map<string_view, size_t> raw_query_to_unique;
+    batch.unique_query_indexes.resize(raw_queries.size());
+    for (size_t i = 0; i < raw_queries.size(); ++i) {
+        const auto [it, inserted] = raw_query_to_unique.emplace(raw_queries[i], batch.plans.size());
+        if (inserted) {
+            batch.plans.push_back(PlanQuery(ParseQuery(raw_queries[i])));
+        }
+        batch.unique_query_indexes[i] = it->second;
+    }
+    return batch;
 }
 
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
-    // vector<string_view> a =SplitIntoWordsViewW(raw_query); //555
-    const Query query = ParseQuery(raw_query.data());
-    std::vector<std::string_view> matched_words;
-    for (std::string_view word : query.plus_words) {
-        if (word_to_document_freqs_.count(std::string(word)) == 0) {
-            continue;
+void SearchServer::GetBatchTerms(const QueryPlan* plans, size_t plan_count, vector<BatchTerm>& terms, vector<size_t>& term_queries) {
+    struct TermOccurrence {
+        int document_count;
+        string_view word;
+        int term_id;
+        double inverse_document_freq;
+        size_t query_index;
+    };
+    vector<TermOccurrence> occurrences;
+    for (size_t query_index = 0; query_index < plan_count; ++query_index) {
+        for (const PlannedTerm& term : plans[query_index].plus_terms) {
+            occurrences.push_back({ term.document_count, term.word, term.term_id, term.inverse_document_freq, query_index });
         }
-        if (word_to_document_freqs_.at(std::string(word)).count(document_id)) {
-            // auto t=std::find(a.begin(), a.end(), string_view(word));//555
-            matched_words.push_back(word_to_document_freqs_.find(std::string(word))->first);
-            // matched_words.push_back(string_view(word));
+    }
+    // Shortest lists first, equal lengths by word: for any one query this is its plan order,
+    // so every score is summed in the same order as FindTopDocuments sums it
+    sort(occurrences.begin(), occurrences.end(), [](const TermOccurrence& lhs, const TermOccurrence& rhs) {
+        return tie(lhs.document_count, lhs.word, lhs.query_index) < tie(rhs.document_count, rhs.word, rhs.query_index);
+        });
+    terms.clear();
+    term_queries.clear();
+    for (const TermOccurrence& occurrence : occurrences) {
+        if (terms.empty() || terms.back().term_id != occurrence.term_id) {
+            terms.push_back({ occurrence.term_id, occurrence.inverse_document_freq, term_queries.size(), term_queries.size() });
         }
+        term_queries.push_back(occurrence.query_index);
+        terms.back().last_query = term_queries.size();
     }
-    for (std::string_view word : query.minus_words) {
-        if (word_to_document_freqs_.count(std::string(word)) == 0) {
-            continue;
+}
+
+void SearchServer::WriteBatchHits(const BatchPlan& batch, const vector<array<SearchHit, MAX_RESULT_DOCUMENT_COUNT>>& unique_hits,
+    const vector<size_t>& unique_hit_counts, vector<SearchHit>& hits, vector<size_t>& hit_offsets) {
+    const size_t query_count = batch.unique_query_indexes.size();
+    hit_offsets.resize(query_count + 1);
+    hit_offsets[0] = 0;
+    for (size_t i = 0; i < query_count; ++i) {
+        hit_offsets[i + 1] = hit_offsets[i] + unique_hit_counts[batch.unique_query_indexes[i]];
+    }
+    hits.resize(hit_offsets.back());
+    for (size_t i = 0; i < query_count; ++i) {
+        const auto& query_hits = unique_hits[batch.unique_query_indexes[i]];
+        copy(query_hits.begin(), query_hits.begin() + (hit_offsets[i + 1] - hit_offsets[i]), hits.begin() + hit_offsets[i]);
+    }
+}
+
+// Position of the lowest set bit of a non-zero value. Multiplying the isolated bit by a
+// de Bruijn constant puts a distinct pattern in the top 6 bits for every position
+int SearchServer::FindLowestSetBit(uint64_t bits) {
+    static constexpr int POSITIONS[64] = {
+        0, 1, 48, 2, 57, 49, 28, 3, 61, 58, 50, 42, 38, 29, 17, 4,
+        62, 55, 59, 36, 53, 51, 43, 22, 45, 39, 33, 30, 24, 18, 12, 5,
+        63, 47, 56, 27, 60, 41, 37, 16, 54, 35, 52, 21, 44, 32, 23, 11,
+        46, 26, 40, 15, 34, 20, 31, 10, 25, 14, 19, 9, 13, 8, 7, 6,
+    };
+    return POSITIONS[((bits & (~bits + 1)) * 0x03f79d71b4cb0a89ULL) >> 58];
+}
+
+int SearchServer::GetDocumentCount() const {
+    const ReadLock lock(*this);
+    return document_ids_.size();
+}
+
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(std::string_view raw_query, int document_id) const {
+    const ReadLock lock(*this);
+    const Query query = ParseQuery(std::string(raw_query));
+    const DocumentLocation location = LocateDocument(document_id);
+    const DocumentStatus status = location.segment->GetDocument(location.document_index).status;
+    const auto [first, last] = location.segment->GetTermFreqs(location.document_index);
+
+    for (const string& word : query.minus_words) {
+        const int term_id = FindTermId(word);
+        if (term_id >= 0 && HasTerm(first, last, term_id)) {
+            return { std::vector<std::string_view>{}, status };
         }
-        if (word_to_document_freqs_.at(std::string(word)).count(document_id)) {
-            matched_words.clear();
-            break;
+    }
+    std::vector<std::string_view> matched_words;
+    for (const string& word : query.plus_words) {
+        const int term_id = FindTermId(word);
+        if (term_id >= 0 && HasTerm(first, last, term_id)) {
+            matched_words.push_back(term_words_[term_id]);
         }
     }
-    return { matched_words, documents_.at(document_id).status };
+    return { matched_words, status };
 }
 
 
-bool SearchServer::IsStopWord(const string word) const {
+bool SearchServer::IsStopWord(string_view word) const {
     return stop_words_.count(word) > 0;
 }
 
 bool SearchServer::IsValidWord(string_view word) {
     // A valid word must not contain special characters
-    std::string wordloc = static_cast<std::string>(word.data());
-    return none_of(wordloc.begin(), wordloc.end(), [](char c) {
+    return none_of(word.begin(), word.end(), [](char c) {
         return c >= '\0' && c < ' ';
         });
 }
 
-vector<string> SearchServer::SplitIntoWordsNoStop(const string text) const {
-    vector<string> words;
-    for (const string word : SplitIntoWords(text)) {
+vector<string_view> SearchServer::SplitIntoWordsNoStop(string_view text) const {
+    vector<string_view> words;
+    for (const string_view word : SplitIntoWordsView(text)) {
         if (!IsValidWord(word)) {
-            throw std::invalid_argument("Word "s + " is invalid"s);
+            throw std::invalid_argument("Word "s + string(word) + " is invalid"s);
         }
         if (!IsStopWord(word)) {
             words.push_back(word);
@@ -137,7 +278,76 @@ SearchServer::Query SearchServer::ParseQuery(const string text) const {
     return result;
 }
 int SearchServer::GetDocumentId(int index) const {
-    return 0;
+    const ReadLock lock(*this);
+    if (index < 0 || index >= static_cast<int>(document_ids_.size())) {
+        throw out_of_range("Document index is out of range"s);
+    }
+    return *next(document_ids_.begin(), index);
+}
+
+size_t SearchServer::GetPostingLength(string_view word) const {
+    const ReadLock lock(*this);
+    const int term_id = FindTermId(word);
+    return term_id < 0 ? 0 : term_document_counts_[term_id];
+}
+
+IndexStats SearchServer::GetIndexStats() const {
+    const ReadLock lock(*this);
+    const auto segments = GetSegments();
+    IndexStats stats;
+    stats.document_count = document_ids_.size();
+
+    stats.dictionary_bytes = EstimateMapNodesBytes(word_to_term_id_) + term_words_.capacity() * sizeof(string_view);
+    for (const auto& [word, _] : word_to_term_id_) {
+        stats.dictionary_bytes += EstimateStringBytes(word);
+    }
+
+    // Terms whose documents were all removed stay in the dictionary but have no live postings
+    stats.posting_length_histogram.resize(1);
+    vector<size_t> posting_lengths;
+    posting_lengths.reserve(term_document_counts_.size());
+    for (const int length : term_document_counts_) {
+        if (length == 0) {
+            ++stats.posting_length_histogram[0];
+        }
+        else {
+            posting_lengths.push_back(length);
+        }
+    }
+    stats.term_count = posting_lengths.size();
+    for (const size_t length : posting_lengths) {
+        stats.total_postings += length;
+        size_t bucket = 0;
+        for (size_t rest = length; rest > 0; rest >>= 1) {
+            ++bucket;
+        }
+        if (stats.posting_length_histogram.size() <= bucket) {
+            stats.posting_length_histogram.resize(bucket + 1);
+        }
+        ++stats.posting_length_histogram[bucket];
+    }
+    if (!posting_lengths.empty()) {
+        const auto middle = posting_lengths.begin() + posting_lengths.size() / 2;
+        nth_element(posting_lengths.begin(), middle, posting_lengths.end());
+        stats.median_posting_length = *middle;
+        const auto [min_it, max_it] = minmax_element(posting_lengths.begin(), posting_lengths.end());
+        stats.min_posting_length = *min_it;
+        stats.max_posting_length = *max_it;
+        stats.average_posting_length = static_cast<double>(stats.total_postings) / posting_lengths.size();
+    }
+
+    stats.inverted_index_bytes = term_document_counts_.capacity() * sizeof(int);
+    stats.document_data_bytes = document_ids_.size() * (MAP_NODE_OVERHEAD + sizeof(int));
+    for (const auto& segment : *segments) {
+        if (segment->GetDocumentCount() > 0) {
+            ++stats.segment_count;
+        }
+        stats.deleted_document_count += segment->GetDeletedCount();
+        stats.inverted_index_bytes += segment->GetPostingBytes();
+        stats.forward_index_bytes += segment->GetForwardIndexBytes();
+        stats.document_data_bytes += segment->GetDocumentBytes();
+    }
+    return stats;
 }
 std::set<int>::iterator SearchServer::begin() {
     return document_ids_.begin();
@@ -147,41 +357,489 @@ std::set<int>::iterator SearchServer::end() {
     return document_ids_.end();
 }
 
-const std::map<std::string_view, double> SearchServer::GetWordFrequencies(int document_id) const {
-    if (SearchServer::document_to_word_freqs_.count(document_id)) {
-        std::map<std::string_view, double> tmp_view;
-        std::map<std::string, double> tmp = SearchServer::document_to_word_freqs_.at(document_id);
-        for (std::pair t : tmp)
+std::set<int>::const_iterator SearchServer::begin() const {
+    return document_ids_.begin();
+}
+
+std::set<int>::const_iterator SearchServer::end() const {
+    return document_ids_.end();
+}
+
+DocumentTermsView SearchServer::GetWordFrequencies(int document_id) const {
+    const ReadLock lock(*this);
+    if (document_ids_.count(document_id) == 0) {
+        return {};
+    }
+    const DocumentLocation location = LocateDocument(document_id);
+    return { location.segment, location.document_index, &term_words_ };
+}
+
+
+void SearchServer::RemoveDocument(int document_id) {
+    RemoveDocument(execution::seq, document_id);
+}
+
+void SearchServer::SetWriteAheadLog(WriteAheadLog* log) {
+    const unique_lock lock(index_mutex_);
+    write_ahead_log_ = log;
+    if (log) {
+        // After a snapshot truncated the log, its numbering must still go on from the index's
+        log->SkipSequencesBelow(log_sequence_ + 1);
+    }
+}
+
+uint64_t SearchServer::GetLogSequence() const {
+    const ReadLock lock(*this);
+    return log_sequence_;
+}
+
+void SearchServer::SaveSnapshot(const string& path) {
+    // Only sealed segments are saved. Sealing takes the index exclusively, but the snapshot is
+    // written under a shared lock, so queries go on meanwhile; documents added in between are sealed in turn
+    shared_lock read_lock(index_mutex_);
+    while (GetSegments()->back()->GetDocumentCount() > 0) {
+        read_lock.unlock();
         {
-            tmp_view.insert(std::pair<std::string_view, bool>{t.first, t.second });
+            const unique_lock write_lock(index_mutex_);
+            if (GetSegments()->back()->GetDocumentCount() > 0) {
+                SealMutableSegment();
+            }
         }
-        return tmp_view;
+        read_lock.lock();
+    }
+    // Tombstones only change under the exclusive lock, so the segments can be read without segments_mutex_
+    const auto segments = GetSegments();
+    const string temporary_path = path + ".tmp"s;
+    {
+        DurableFile file(temporary_path, true);
+        BinaryWriter writer(file);
+        writer.WriteString(SNAPSHOT_FORMAT);
+        writer.Write(log_sequence_);
+        writer.Write(static_cast<uint64_t>(stop_words_.size()));
+        for (const string& word : stop_words_) {
+            writer.WriteString(word);
+        }
+        writer.Write(static_cast<uint64_t>(term_words_.size()));
+        for (const string_view word : term_words_) {
+            writer.WriteString(word);
+        }
+        writer.WriteVector(term_document_counts_);
+        writer.Write(total_word_count_);
+        writer.Write(static_cast<uint64_t>(segments->size() - 1));
+        for (size_t i = 0; i + 1 < segments->size(); ++i) {
+            (*segments)[i]->Save(writer);
+        }
+        writer.WriteString(SNAPSHOT_END);
+        writer.Flush();
+        file.Sync();
+    }
+    ReplaceFileDurably(temporary_path, path);
+    if (write_ahead_log_) {
+        write_ahead_log_->Truncate();
+    }
+}
+
+void SearchServer::LoadSnapshot(const string& path) {
+    const unique_lock lock(index_mutex_);
+    if (!document_ids_.empty() || !term_words_.empty()) {
+        throw invalid_argument("A snapshot can only be loaded into an empty server"s);
     }
-    else {
+    ifstream in(path, ios::binary);
+    if (!in) {
+        throw runtime_error("Can't open snapshot "s + path);
+    }
+    const auto throw_damaged = [&path] {
+        throw runtime_error("Damaged snapshot "s + path);
+    };
 
-        return emptyMap;
+    // Everything is read into locals first, so a damaged file leaves the server empty
+    BinaryReader reader(in);
+    if (reader.ReadString() != SNAPSHOT_FORMAT) {
+        throw runtime_error(path + " is not a search server snapshot"s);
+    }
+    const uint64_t log_sequence = reader.Read<uint64_t>();
+    set<string, less<>> stop_words;
+    for (uint64_t i = reader.Read<uint64_t>(); i > 0; --i) {
+        stop_words.insert(reader.ReadString());
+    }
+    map<string, int, less<>> word_to_term_id;
+    vector<string_view> term_words;
+    const uint64_t term_count = reader.Read<uint64_t>();
+    for (uint64_t i = 0; i < term_count; ++i) {
+        const auto [term_it, inserted] = word_to_term_id.emplace(reader.ReadString(), static_cast<int>(i));
+        if (!inserted) {
+            throw_damaged();
+        }
+        term_words.push_back(term_it->first);
+    }
+    vector<int> term_document_counts = reader.ReadVector<int>();
+    if (term_document_counts.size() != term_count) {
+        throw_damaged();
     }
+    const long long total_word_count = reader.Read<long long>();
+    auto segments = make_shared<SegmentList>();
+    for (uint64_t i = reader.Read<uint64_t>(); i > 0; --i) {
+        segments->push_back(IndexSegment::Load(reader, term_count));
+    }
+    if (reader.ReadString() != SNAPSHOT_END) {
+        throw_damaged();
+    }
+    set<int> document_ids;
+    for (const auto& segment : *segments) {
+        for (int i = 0; i < static_cast<int>(segment->GetDocumentCount()); ++i) {
+            if (!segment->IsDeleted(i) && !document_ids.insert(segment->GetDocument(i).id).second) {
+                throw_damaged();
+            }
+        }
+    }
+    segments->push_back(make_shared<IndexSegment>());
+
+    // Moving the map keeps its nodes, so term_words still points at its keys
+    stop_words_ = move(stop_words);
+    word_to_term_id_ = move(word_to_term_id);
+    term_words_ = move(term_words);
+    term_document_counts_ = move(term_document_counts);
+    document_ids_ = move(document_ids);
+    total_word_count_ = total_word_count;
+    log_sequence_ = log_sequence;
+    {
+        lock_guard guard(segments_mutex_);
+        segments_ = move(segments);
+        if (segment_options_.background_merges && !merger_.joinable()) {
+            merger_ = thread([this] { RunMerges(); });
+        }
+    }
+    merges_changed_.notify_all();
 }
 
+void SearchServer::SetSegmentOptions(const SegmentOptions& options) {
+    const unique_lock lock(index_mutex_);
+    {
+        lock_guard guard(segments_mutex_);
+        segment_options_ = options;
+        segment_options_.mutable_segment_capacity = max(segment_options_.mutable_segment_capacity, size_t(1));
+        segment_options_.merge_factor = max(segment_options_.merge_factor, size_t(2));
+    }
+    merges_changed_.notify_all();
+}
 
-void SearchServer::RemoveDocument(int document_id) {
-    int dc = document_to_word_freqs_.count(document_id);
-    if (dc != 0) {
+void SearchServer::MergeAllSegments() {
+    {
+        // Like a background merge, the merge itself runs alongside queries and changes
+        const unique_lock lock(index_mutex_);
+        if (GetSegments()->back()->GetDocumentCount() > 0) {
+            SealMutableSegment();
+        }
+    }
+    unique_lock lock(segments_mutex_);
+    merges_changed_.wait(lock, [this] { return !merging_; });
+    const SegmentList inputs(segments_->begin(), segments_->end() - 1);
+    if (inputs.size() > 1 || (inputs.size() == 1 && inputs.front()->GetDeletedCount() > 0)) {
+        MergeSegments(inputs, lock);
+    }
+}
+
+void SearchServer::SetMinTermInverseDocumentFreq(double min_idf) {
+    const unique_lock lock(index_mutex_);
+    min_term_inverse_document_freq_ = min_idf;
+}
+
+
+void SearchServer::InsertTopHit(const SearchHit& hit, SearchHit* hits, size_t& hit_count, size_t capacity) {
+    // Full ties go to the lower id, so the result doesn't depend on the order segments are searched in
+    const auto ranks_before = [](const SearchHit& lhs, const SearchHit& rhs) {
+        if (abs(lhs.relevance - rhs.relevance) < 1e-6) {
+            return lhs.rating != rhs.rating ? lhs.rating > rhs.rating : lhs.id < rhs.id;
+        }
+        else {
+            return lhs.relevance > rhs.relevance;
+        }
+    };
+    size_t position = hit_count;
+    while (position > 0 && ranks_before(hit, hits[position - 1])) {
+        --position;
+    }
+    if (position >= capacity) {
+        return;
+    }
+    // When the buffer is full its last hit drops out
+    for (size_t i = min(hit_count, capacity - 1); i > position; --i) {
+        hits[i] = hits[i - 1];
+    }
+    hits[position] = hit;
+    hit_count = min(hit_count + 1, capacity);
+}
+
+double SearchServer::GetAverageDocumentLength() const {
+    return document_ids_.empty() ? 0.0 : static_cast<double>(total_word_count_) / document_ids_.size();
+}
+
+SearchServer::QueryPlan SearchServer::PlanQuery(const Query& query) const {
+    QueryPlan plan;
+    for (const string& word : query.plus_words) {
+        const int term_id = FindTermId(word);
+        if (term_id < 0 || term_document_counts_[term_id] == 0) {
+            continue;
+        }
+        const int document_count = term_document_counts_[term_id];
+        const double inverse_document_freq = ComputeWordInverseDocumentFreq(document_count);
+        if (inverse_document_freq < min_term_inverse_document_freq_) {
+            continue;
+        }
+        plan.plus_terms.push_back({ term_words_[term_id], term_id, document_count, inverse_document_freq });
+    }
+    // Nothing will be scored, so the minus words need no work either
+    if (plan.plus_terms.empty()) {
+        return plan;
+    }
+    // Shortest lists first; equal lengths keep the word order, so the sums are reproducible
+    stable_sort(plan.plus_terms.begin(), plan.plus_terms.end(), [](const PlannedTerm& lhs, const PlannedTerm& rhs) {
+        return lhs.document_count < rhs.document_count;
+        });
+
+    for (const string& word : query.minus_words) {
+        const int term_id = FindTermId(word);
+        if (term_id >= 0 && term_document_counts_[term_id] > 0) {
+            plan.minus_term_ids.push_back(term_id);
+        }
+    }
+    return plan;
+}
+
+SearchServer::ExcludedDocuments::ExcludedDocuments(const QueryPlan& plan, const SegmentRange& range, size_t candidate_count)
+    : first_index_(range.first_index)
+{
+    // A lookup gallops through the list, about log2(postings) steps per candidate; the bitmap costs a write
+    // per posting once, plus clearing a word per 64 documents of the range if any minus word needs it
+    vector<PostingList> bitmap_postings;
+    double bitmap_savings = 0.0;
+    for (const int term_id : plan.minus_term_ids) {
+        const PostingList postings = range.segment->GetPostings(term_id).Slice(range.first_index, range.last_index);
+        if (postings.empty()) {
+            continue;
+        }
+        const double lookup_cost = static_cast<double>(candidate_count) * (1.0 + log2(static_cast<double>(postings.size())));
+        const double bitmap_cost = static_cast<double>(postings.size());
+        if (lookup_cost <= bitmap_cost) {
+            inline_postings_.push_back(postings);
+        }
+        else {
+            bitmap_postings.push_back(postings);
+            bitmap_savings += lookup_cost - bitmap_cost;
+        }
+    }
+    if (bitmap_postings.empty()) {
+        return;
+    }
+    const size_t range_size = static_cast<size_t>(range.last_index - range.first_index);
+    if (bitmap_savings <= static_cast<double>(range_size / 64 + 1)) {
+        inline_postings_.insert(inline_postings_.end(), bitmap_postings.begin(), bitmap_postings.end());
         return;
     }
-    document_to_word_freqs_.erase(document_id);
-    for (auto& w : word_to_document_freqs_) {
-        if (w.second.count(document_id)) {
-            w.second.erase(document_id);
+    bitmap_.assign(range_size, false);
+    for (const PostingList& postings : bitmap_postings) {
+        for (const Posting& posting : postings) {
+            bitmap_[posting.document_index - first_index_] = true;
+        }
+    }
+}
+
+vector<SearchServer::SegmentRange> SearchServer::SplitIntoRanges(const SegmentList& segments, int range_documents) {
+    vector<SegmentRange> ranges;
+    for (const auto& segment : segments) {
+        const int document_count = static_cast<int>(segment->GetDocumentCount());
+        for (int first_index = 0; first_index < document_count; first_index += range_documents) {
+            ranges.push_back({ segment.get(), first_index, min(first_index + range_documents, document_count) });
+        }
+    }
+    return ranges;
+}
+
+namespace {
+// Servers the calling thread holds a ReadLock on
+thread_local vector<const SearchServer*> read_locked_servers;
+}
+
+SearchServer::ReadLock::ReadLock(const SearchServer& search_server) {
+    if (find(read_locked_servers.begin(), read_locked_servers.end(), &search_server) == read_locked_servers.end()) {
+        read_locked_servers.push_back(&search_server);
+        search_server.index_mutex_.lock_shared();
+        locked_server_ = &search_server;
+    }
+}
+
+SearchServer::ReadLock::~ReadLock() {
+    if (locked_server_) {
+        locked_server_->index_mutex_.unlock_shared();
+        read_locked_servers.erase(find(read_locked_servers.begin(), read_locked_servers.end(), locked_server_));
+    }
+}
+
+shared_ptr<const SearchServer::SegmentList> SearchServer::MakeEmptySegmentList() {
+    return make_shared<const SegmentList>(1, make_shared<IndexSegment>());
+}
+
+shared_ptr<const SearchServer::SegmentList> SearchServer::GetSegments() const {
+    lock_guard guard(segments_mutex_);
+    return segments_;
+}
+
+SearchServer::DocumentLocation SearchServer::LocateDocument(int document_id) const {
+    if (document_ids_.count(document_id) > 0) {
+        const auto segments = GetSegments();
+        for (const auto& segment : *segments) {
+            const int document_index = segment->FindDocument(document_id);
+            if (document_index >= 0) {
+                return { segment, document_index };
+            }
+        }
+    }
+    throw out_of_range("Document "s + to_string(document_id) + " is not indexed"s);
+}
+
+SearchServer::DocumentLocation SearchServer::MarkDocumentDeleted(int document_id) {
+    // Under the lock, so a merge in progress either sees the tombstone or re-applies it
+    lock_guard guard(segments_mutex_);
+    for (const auto& segment : *segments_) {
+        const int document_index = segment->FindDocument(document_id);
+        if (document_index >= 0) {
+            segment->MarkDeleted(document_index);
+            return { segment, document_index };
+        }
+    }
+    throw out_of_range("Document "s + to_string(document_id) + " is not indexed"s);
+}
+
+void SearchServer::SealMutableSegment() {
+    {
+        lock_guard guard(segments_mutex_);
+        auto segments = make_shared<SegmentList>(*segments_);
+        segments->back()->Seal();
+        segments->push_back(make_shared<IndexSegment>());
+        segments_ = move(segments);
+        if (segment_options_.background_merges && !merger_.joinable()) {
+            merger_ = thread([this] { RunMerges(); });
+        }
+    }
+    merges_changed_.notify_all();
+}
+
+void SearchServer::RunMerges() {
+    unique_lock lock(segments_mutex_);
+    while (true) {
+        SegmentList inputs;
+        merges_changed_.wait(lock, [&] {
+            if (stopping_merges_) {
+                return true;
+            }
+            if (merging_ || !segment_options_.background_merges) {
+                return false;
+            }
+            inputs = PickMergeInputs(*segments_, segment_options_);
+            return !inputs.empty();
+            });
+        if (stopping_merges_) {
+            return;
+        }
+        try {
+            MergeSegments(inputs, lock);
+        }
+        catch (...) {
+            // Out of memory: the index stays correct with more segments, MergeAllSegments() can retry
+            return;
+        }
+    }
+}
+
+void SearchServer::MergeSegments(const SegmentList& inputs, unique_lock<mutex>& lock) {
+    vector<const IndexSegment*> sources;
+    vector<vector<bool>> tombstones;
+    for (const auto& segment : inputs) {
+        sources.push_back(segment.get());
+        tombstones.push_back(segment->GetTombstones());
+    }
+    merging_ = true;
+    lock.unlock();
+    vector<vector<int>> index_maps;
+    shared_ptr<IndexSegment> merged;
+    try {
+        merged = IndexSegment::Merge(sources, tombstones, index_maps);
+    }
+    catch (...) {
+        lock.lock();
+        merging_ = false;
+        merges_changed_.notify_all();
+        throw;
+    }
+    lock.lock();
+
+    // Documents removed while the merge ran
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const auto& current_tombstones = inputs[i]->GetTombstones();
+        for (size_t j = 0; j < current_tombstones.size(); ++j) {
+            if (current_tombstones[j] && !tombstones[i][j]) {
+                merged->MarkDeleted(index_maps[i][j]);
+            }
+        }
+    }
+    // The merged segment takes the place of the first input
+    auto segments = make_shared<SegmentList>();
+    segments->reserve(segments_->size());
+    for (const auto& segment : *segments_) {
+        if (segment == inputs.front()) {
+            if (merged->GetDocumentCount() > merged->GetDeletedCount()) {
+                segments->push_back(merged);
+            }
+        }
+        else if (find(inputs.begin(), inputs.end(), segment) == inputs.end()) {
+            segments->push_back(segment);
         }
     }
-    documents_.erase(document_id);
-    document_ids_.erase(document_id);
+    segments_ = move(segments);
+    merging_ = false;
+    merges_changed_.notify_all();
+}
 
+SearchServer::SegmentList SearchServer::PickMergeInputs(const SegmentList& segments, const SegmentOptions& options) {
+    // The last segment is the mutable one
+    const size_t sealed_count = segments.size() - 1;
+    // A segment that lost half of its documents is rewritten on its own
+    for (size_t i = 0; i < sealed_count; ++i) {
+        const size_t deleted_count = segments[i]->GetDeletedCount();
+        if (deleted_count > 0 && deleted_count * 2 >= segments[i]->GetDocumentCount()) {
+            return { segments[i] };
+        }
+    }
+    // Otherwise merge_factor segments of one size tier; tier t holds the segments
+    // with fewer than capacity * factor^(t + 1) live documents
+    map<size_t, SegmentList> tiers;
+    for (size_t i = 0; i < sealed_count; ++i) {
+        const size_t live_count = segments[i]->GetDocumentCount() - segments[i]->GetDeletedCount();
+        size_t tier = 0;
+        for (size_t limit = options.mutable_segment_capacity * options.merge_factor; live_count >= limit; limit *= options.merge_factor) {
+            ++tier;
+        }
+        auto& tier_segments = tiers[tier];
+        tier_segments.push_back(segments[i]);
+        if (tier_segments.size() == options.merge_factor) {
+            return tier_segments;
+        }
+    }
+    return {};
+}
+
+int SearchServer::FindTermId(string_view word) const {
+    const auto term_it = word_to_term_id_.find(word);
+    return term_it == word_to_term_id_.end() ? -1 : term_it->second;
 }
 
+bool SearchServer::HasTerm(const TermFrequency* first, const TermFrequency* last, int term_id) {
+    const auto it = lower_bound(first, last, term_id, [](const TermFrequency& term_freq, int id) {
+        return term_freq.term_id < id;
+        });
+    return it != last && it->term_id == term_id;
+}
 
-// Existence required
-double SearchServer::ComputeWordInverseDocumentFreq(const string word) const {
-    return log(GetDocumentCount() * 1.0 / word_to_document_freqs_.at(word).size());
-}
\ No newline at end of file
+double SearchServer::ComputeWordInverseDocumentFreq(int document_count) const {
+    return log(document_ids_.size() * 1.0 / document_count);
+}
@@ -1,19 +1,152 @@
 #pragma once
 
 #include "document.h"
+#include "index_segment.h"
+#include "scoring.h"
 #include "string_processing.h"
+#include "thread_pool.h"
+#include "write_ahead_log.h"
 #include <algorithm>
+#include <array>
+#include <climits>
+#include <condition_variable>
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
 #include <set>
+#include <shared_mutex>
 #include <stdexcept>
 #include <string>
+#include <thread>
+#include <type_traits>
 #include <vector>
 #include <execution>
 #include <future>
+#include <iterator>
+#include <limits>
 #include <atomic>
 
 const int MAX_RESULT_DOCUMENT_COUNT = 5;
 
+struct IngestOptions;
+struct IngestStats;
+
+// Read-only view of one document's (word, term frequency) pairs, ordered by the
+// server's internal term id rather than alphabetically. It points into the document's
+// segment and keeps that alive; a view of a document in the mutable segment is
+// invalidated by AddDocument
+class DocumentTermsView {
+public:
+    // operator* returns the pair by value, which a forward iterator may not do, so this is
+    // an input iterator; the view itself can still be iterated any number of times
+    class Iterator {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::pair<std::string_view, double>;
+        using difference_type = std::ptrdiff_t;
+        using pointer = void;
+        using reference = value_type;
+
+        Iterator(const TermFrequency* position, const std::vector<std::string_view>* term_words)
+            : position_(position), term_words_(term_words) {
+        }
+
+        value_type operator*() const {
+            return { (*term_words_)[position_->term_id], position_->term_freq };
+        }
+        Iterator& operator++() {
+            ++position_;
+            return *this;
+        }
+        Iterator operator++(int) {
+            Iterator previous = *this;
+            ++position_;
+            return previous;
+        }
+        bool operator==(const Iterator& other) const {
+            return position_ == other.position_;
+        }
+        bool operator!=(const Iterator& other) const {
+            return position_ != other.position_;
+        }
+
+    private:
+        const TermFrequency* position_;
+        const std::vector<std::string_view>* term_words_;
+    };
+
+    DocumentTermsView() = default;
+    DocumentTermsView(std::shared_ptr<const IndexSegment> segment, int document_index, const std::vector<std::string_view>* term_words)
+        : segment_(std::move(segment)), term_words_(term_words) {
+        std::tie(first_, last_) = segment_->GetTermFreqs(document_index);
+    }
+
+    Iterator begin() const {
+        return { first_, term_words_ };
+    }
+    Iterator end() const {
+        return { last_, term_words_ };
+    }
+    size_t size() const {
+        return last_ - first_;
+    }
+    bool empty() const {
+        return first_ == last_;
+    }
+
+private:
+    std::shared_ptr<const IndexSegment> segment_;
+    const TermFrequency* first_ = nullptr;
+    const TermFrequency* last_ = nullptr;
+    const std::vector<std::string_view>* term_words_ = nullptr;
+};
+
+struct IndexStats {
+    size_t document_count = 0;
+    // Terms of live documents. The posting figures below count live postings of those terms only;
+    // the dictionary keeps the words of removed documents, which only posting_length_histogram[0] counts
+    size_t term_count = 0;
+    size_t segment_count = 0;
+    // Removed documents still in their segments, until a merge rewrites those
+    size_t deleted_document_count = 0;
+    size_t total_postings = 0;
+    size_t min_posting_length = 0;
+    size_t max_posting_length = 0;
+    size_t median_posting_length = 0;
+    double average_posting_length = 0.0;
+    // posting_length_histogram[0] counts dictionary terms with no live postings left,
+    // posting_length_histogram[i] counts terms with length in [2^(i-1), 2^i)
+    std::vector<size_t> posting_length_histogram;
+
+    // Estimated heap usage, including container node overhead
+    size_t dictionary_bytes = 0;
+    size_t inverted_index_bytes = 0;
+    size_t forward_index_bytes = 0;
+    size_t document_data_bytes = 0;
+
+    size_t GetTotalBytes() const;
+};
+
+struct SegmentOptions {
+    // The mutable segment is sealed once it holds this many documents
+    size_t mutable_segment_capacity = 8192;
+    // A background thread merges this many sealed segments of similar size into one
+    size_t merge_factor = 4;
+    // false leaves merging to MergeAllSegments()
+    bool background_merges = true;
+};
+
+// The index is split into segments. New documents go to a small mutable segment, which is
+// sealed (made immutable) once full; a background thread merges sealed segments, and a
+// removal only sets a tombstone until the merge drops the document. Queries search every
+// segment and merge the top hits. Queries may run concurrently with each other and with
+// changes to the index: queries share the index lock, while adding and removing documents,
+// sealing, loading and changing settings take it exclusively. Merges run alongside both.
+// begin()/end() and the views of GetWordFrequencies don't lock, so they must not be used
+// while another thread changes the index.
 class SearchServer {
 public:
     template <typename StringContainer>
@@ -21,41 +154,125 @@ public:
     explicit SearchServer(const std::string& stop_words_text);
     template <typename StringContainer>
     explicit SearchServer(std::string_view stop_words_text);
-    
-    void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    SearchServer(const SearchServer&) = delete;
+    SearchServer& operator=(const SearchServer&) = delete;
+    // Waits for a merge in progress
+    ~SearchServer();
 
-    template <typename DocumentPredicate>
+    void AddDocument(int document_id, const std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    // Words of text that AddDocument indexes: stop words are dropped, a word with control characters
+    // throws std::invalid_argument. Only reads the stop words, so it may run concurrently with anything
+    // but LoadSnapshot
+    std::vector<std::string_view> SplitIntoWordsNoStop(std::string_view text) const;
+
+    // ScoringModel is one of the models from scoring.h, e.g. FindTopDocuments<Bm25Scoring<>>(query, DocumentStatus::ACTUAL).
+    // The predicate is StatusIs, RatingAtLeast, a plain DocumentStatus or any callable; see scoring.h for how each is evaluated
+    template <typename ScoringModel = TfIdfScoring, typename DocumentPredicate>
     std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentPredicate document_predicate) const;
+    template <typename ScoringModel>
+    std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
     std::vector<Document> FindTopDocuments(const std::string_view raw_query, DocumentStatus status) const;
     std::vector<Document> FindTopDocuments(const std::string_view raw_query) const;
-    template <typename DocumentPredicate, typename ExecutionPolicy>
+    // policy is std::execution::seq/par, a ThreadPool or pool.Limit(max_concurrency); par runs on ThreadPool::GetDefault()
+    template <typename ScoringModel = TfIdfScoring, typename DocumentPredicate, typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate document_predicate) const;
-    template <typename ExecutionPolicy>
-    std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status) const;
-    template <typename ExecutionPolicy>
+    template <typename ScoringModel = TfIdfScoring, typename ExecutionPolicy>
     std::vector<Document> FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query) const;
 
+    // Variants that return the results in the caller's storage instead of a new vector; parsing the
+    // query and scanning still use temporary buffers. The first writes at most
+    // min(hit_capacity, MAX_RESULT_DOCUMENT_COUNT) hits, best first, and returns their number;
+    // with hit_capacity 0 it only checks the query, and hits may be nullptr.
+    // The second reuses the vector's storage, so a vector kept between calls stops allocating
+    template <typename ScoringModel = TfIdfScoring, typename DocumentPredicate>
+    size_t FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, SearchHit* hits, size_t hit_capacity) const;
+    template <typename ScoringModel = TfIdfScoring, typename DocumentPredicate>
+    void FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, std::vector<SearchHit>& hits) const;
+
+    // Same as calling FindTopDocuments(raw_query) for every query, but the batch is parsed up front
+    // and evaluated BATCH_CHUNK_QUERIES distinct queries at a time: the segment ranges are scanned
+    // in parallel on thread_pool (pool.Limit(n) caps the threads), and within a range the postings of each distinct plus word are read once
+    // for all queries of the chunk containing it. Throws std::invalid_argument before any work is done
+    // if one of the queries is malformed
+    template <typename ScoringModel = TfIdfScoring>
+    std::vector<std::vector<Document>> FindTopDocumentsBatch(const std::vector<std::string>& raw_queries, LimitedThreadPool thread_pool = ThreadPool::GetDefault()) const;
+    // Flat variant: the hits of query i are hits[hit_offsets[i], hit_offsets[i + 1]).
+    // Both vectors are overwritten and their storage reused
+    template <typename ScoringModel = TfIdfScoring>
+    void FindTopDocumentsBatch(const std::vector<std::string>& raw_queries, std::vector<SearchHit>& hits, std::vector<size_t>& hit_offsets,
+        LimitedThreadPool thread_pool = ThreadPool::GetDefault()) const;
+
     std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(std::string_view raw_query, int document_id) const;
     template <typename ExecutionPolicy>
-    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id, ExecutionPolicy&& policy = std::execution::seq);
+    std::tuple<std::vector<std::string_view>, DocumentStatus> MatchDocument(const std::string_view raw_query, int document_id, ExecutionPolicy&& policy = std::execution::seq) const;
 
-    const std::map<std::string_view, double> GetWordFrequencies(int document_id) const;
+    // No copying: the view reads the document's entry of the forward index directly
+    DocumentTermsView GetWordFrequencies(int document_id) const;
     int GetDocumentCount() const;
     int GetDocumentId(int index) const;
+    size_t GetPostingLength(std::string_view word) const;
+    IndexStats GetIndexStats() const;
 
     template <typename ExecutionPolicy>
     void RemoveDocument(ExecutionPolicy&& policy, int document_id);
     void RemoveDocument(int document_id);
 
+    // Every following AddDocument/RemoveDocument is journaled to log before the index changes.
+    // Pass nullptr to detach. The log must outlive the server or be detached first.
+    void SetWriteAheadLog(WriteAheadLog* log);
+    // Sequence number of the last log record the index reflects, 0 if none
+    uint64_t GetLogSequence() const;
+
+    // Writes the index to path + ".tmp", syncs it and renames it over path. Once the snapshot is
+    // durable the attached write-ahead log is truncated, since the snapshot covers all of its records
+    void SaveSnapshot(const std::string& path);
+    // Loads a snapshot written by SaveSnapshot into this server, which must be empty,
+    // stop words included. Throws std::runtime_error if the file is missing or damaged
+    void LoadSnapshot(const std::string& path);
+
+    // Takes effect from the next sealed segment
+    void SetSegmentOptions(const SegmentOptions& options);
+    // Seals the mutable segment and merges all segments into one, e.g. before serving a corpus
+    // that won't change: a query then walks one posting list per word
+    void MergeAllSegments();
+
+    // Plus words whose IDF is below min_idf are left out of scoring, e.g. words found in
+    // nearly every document. The default 0 keeps every word
+    void SetMinTermInverseDocumentFreq(double min_idf);
+
     std::set<int>::iterator begin();
 
     std::set<int>::iterator end();
 
+    std::set<int>::const_iterator begin() const;
+
+    std::set<int>::const_iterator end() const;
+
 private:
-    struct DocumentData {
-        int rating;
-        DocumentStatus status;
+    friend int ReplayWriteAheadLog(const std::string& path, SearchServer& search_server);
+    friend IngestStats IngestCorpus(const std::string& path, SearchServer& search_server, const IngestOptions& options);
+
+    // AddDocument with the words already split off by SplitIntoWordsNoStop(document) on the parser
+    // thread of IngestCorpus, which is trusted to pass exactly those; checked in debug builds.
+    // document is still needed for the write-ahead log
+    void AddDocument(int document_id, std::string_view document, const std::vector<std::string_view>& words,
+        DocumentStatus status, const std::vector<int>& ratings);
+
+    using SegmentList = std::vector<std::shared_ptr<IndexSegment>>;
+
+    // Shared lock on index_mutex_ for a query. A thread waiting in ParallelFor runs other queued
+    // tasks, possibly queries to the same server, so only a thread's outermost query locks
+    class ReadLock {
+    public:
+        explicit ReadLock(const SearchServer& search_server);
+        ReadLock(const ReadLock&) = delete;
+        ReadLock& operator=(const ReadLock&) = delete;
+        ~ReadLock();
+
+    private:
+        const SearchServer* locked_server_ = nullptr;
     };
+
     struct QueryWord {
         std::string data;
         bool is_minus;
@@ -65,34 +282,209 @@ private:
         std::set<std::string> plus_words;
         std::set<std::string> minus_words;
     };
-    std::set<std::string> stop_words_;
-    std::map<std::string, std::map<int, double>> word_to_document_freqs_;
-    std::map<int, std::map<std::string, double>> document_to_word_freqs_;
-    std::map<int, DocumentData> documents_;
+    struct PlannedTerm {
+        std::string_view word;
+        int term_id;
+        // Live documents containing the word
+        int document_count;
+        double inverse_document_freq;
+    };
+    struct QueryPlan {
+        // Scored plus words in the order their scores are summed: shortest posting list first
+        std::vector<PlannedTerm> plus_terms;
+        std::vector<int> minus_term_ids;
+    };
+    // Documents [first_index, last_index) of one segment, searched as a unit
+    struct SegmentRange {
+        const IndexSegment* segment;
+        int first_index;
+        int last_index;
+    };
+    // Documents of a segment range containing one of the query's minus words. Each minus word is either
+    // marked in a bitmap over the range or looked up per candidate, whichever costs less given its
+    // posting count, the range size and the number of candidates
+    class ExcludedDocuments {
+    public:
+        // candidate_count bounds the documents that will be checked
+        ExcludedDocuments(const QueryPlan& plan, const SegmentRange& range, size_t candidate_count);
+
+        bool Contains(int document_index) const {
+            if (!bitmap_.empty() && bitmap_[document_index - first_index_]) {
+                return true;
+            }
+            return std::any_of(inline_postings_.begin(), inline_postings_.end(), [document_index](const PostingList& postings) {
+                return postings.Contains(document_index);
+                });
+        }
+
+    private:
+        int first_index_;
+        std::vector<bool> bitmap_;
+        std::vector<PostingList> inline_postings_;
+    };
+    // Live documents of a segment range that satisfy an attribute predicate (see is_attribute_predicate_v).
+    // The bitmap is filled from the documents' status and rating 64 documents at a time,
+    // when one of them is first checked
+    template <typename DocumentPredicate>
+    class EligibleDocuments {
+    public:
+        EligibleDocuments(const SegmentRange& range, DocumentPredicate document_predicate)
+            : range_(range)
+            , document_predicate_(document_predicate)
+            , words_(static_cast<size_t>(range.last_index - range.first_index + 63) / 64, 0)
+            , filled_(words_.size(), false) {
+        }
+
+        bool Contains(int document_index) {
+            const size_t offset = static_cast<size_t>(document_index - range_.first_index);
+            const size_t word = offset / 64;
+            if (!filled_[word]) {
+                Fill(word);
+            }
+            return (words_[word] >> (offset % 64)) & 1;
+        }
+
+    private:
+        SegmentRange range_;
+        DocumentPredicate document_predicate_;
+        std::vector<uint64_t> words_;
+        std::vector<bool> filled_;
+
+        void Fill(size_t word) {
+            const int first_index = range_.first_index + static_cast<int>(word * 64);
+            const int last_index = std::min(first_index + 64, range_.last_index);
+            uint64_t bits = 0;
+            for (int document_index = first_index; document_index < last_index; ++document_index) {
+                const SegmentDocument& document = range_.segment->GetDocument(document_index);
+                const bool is_eligible = !range_.segment->IsDeleted(document_index)
+                    && document_predicate_(document.id, document.status, document.rating);
+                bits |= uint64_t(is_eligible) << (document_index - first_index);
+            }
+            words_[word] = bits;
+            filled_[word] = true;
+        }
+    };
+    struct DocumentLocation {
+        std::shared_ptr<IndexSegment> segment;
+        int document_index;
+    };
+    // Plus word of a batch chunk; the chunk queries containing it are term_queries[first_query, last_query)
+    struct BatchTerm {
+        int term_id;
+        double inverse_document_freq;
+        size_t first_query;
+        size_t last_query;
+    };
+    // Distinct queries of a batch: query i of the batch is plans[unique_query_indexes[i]]
+    struct BatchPlan {
+        std::vector<size_t> unique_query_indexes;
+        std::vector<QueryPlan> plans;
+    };
+    // Top hits of one chunk query within one segment range
+    struct BatchQueryHits {
+        size_t query_index;
+        size_t hit_count;
+        std::array<SearchHit, MAX_RESULT_DOCUMENT_COUNT> hits;
+    };
+    // Parallel searches split the segments into ranges of at most this many documents
+    static constexpr int PARALLEL_RANGE_DOCUMENTS = 16384;
+    // Batches are evaluated this many distinct queries at a time, which bounds the scratch memory
+    static constexpr size_t BATCH_CHUNK_QUERIES = 2048;
+    // A batch scores the documents of a range this many at a time, into one dense array per query
+    static constexpr int BATCH_BLOCK_DOCUMENTS = 256;
+
+    std::set<std::string, std::less<>> stop_words_;
+    // Dictionary: every indexed word is stored once, as a key of word_to_term_id_.
+    // term_words_ and term_document_counts_ are indexed by term id
+    std::map<std::string, int, std::less<>> word_to_term_id_;
+    std::vector<std::string_view> term_words_;
+    // Live documents containing each term: its posting length for IDF and query planning
+    std::vector<int> term_document_counts_;
     std::set<int> document_ids_;
-    std::map<std::string_view, double> emptyMap;
-    std::vector<std::string> matched_words_;
-    bool IsStopWord(const std::string word) const;
+    long long total_word_count_ = 0;
+    WriteAheadLog* write_ahead_log_ = nullptr;
+    uint64_t log_sequence_ = 0;
+    double min_term_inverse_document_freq_ = 0.0;
+    SegmentOptions segment_options_;
+    // Guards everything above and the documents and tombstones of the segments; the lock
+    // order is index_mutex_, then segments_mutex_. The merge thread never takes it
+    mutable std::shared_mutex index_mutex_;
+
+    // Segments in search order, the mutable one last. A published list is never changed:
+    // sealing and merging publish a new one under segments_mutex_, so a query keeps searching
+    // the list it started with while a merge replaces it
+    mutable std::mutex segments_mutex_;
+    std::shared_ptr<const SegmentList> segments_ = MakeEmptySegmentList();
+    std::condition_variable merges_changed_;
+    bool merging_ = false;
+    bool stopping_merges_ = false;
+    std::thread merger_;
+
+    bool IsStopWord(std::string_view word) const;
     static bool IsValidWord(std::string_view word);
-    std::vector<std::string> SplitIntoWordsNoStop(const std::string text) const;
     static int ComputeAverageRating(const std::vector<int>& ratings);
 
     QueryWord ParseQueryWord(const std::string text) const;
 
     Query ParseQuery(const std::string text) const;
 
-    double ComputeWordInverseDocumentFreq(const std::string word) const;
-
-    template <typename DocumentPredicate>
-    std::vector<Document> FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const;
-    template <typename DocumentPredicate, typename ExecutionPolicy>
-    std::vector<Document> FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate) const;
+    static std::shared_ptr<const SegmentList> MakeEmptySegmentList();
+    std::shared_ptr<const SegmentList> GetSegments() const;
+    // Throws std::out_of_range if the document isn't indexed
+    DocumentLocation LocateDocument(int document_id) const;
+    // Sets the document's tombstone and returns where it was
+    DocumentLocation MarkDocumentDeleted(int document_id);
+    void SealMutableSegment();
+    void RunMerges();
+    // Replaces inputs, sealed segments of the current list, by their merge.
+    // lock holds segments_mutex_ on entry and on return but not while merging
+    void MergeSegments(const SegmentList& inputs, std::unique_lock<std::mutex>& lock);
+    static SegmentList PickMergeInputs(const SegmentList& segments, const SegmentOptions& options);
+
+    // -1 if the word isn't in the dictionary
+    int FindTermId(std::string_view word) const;
+    static bool HasTerm(const TermFrequency* first, const TermFrequency* last, int term_id);
+    // document_count must not be 0
+    double ComputeWordInverseDocumentFreq(int document_count) const;
+
+    // Inserts hit into hits[0, hit_count), kept best first and at most capacity long
+    static void InsertTopHit(const SearchHit& hit, SearchHit* hits, size_t& hit_count, size_t capacity);
+
+    double GetAverageDocumentLength() const;
+
+    // Throws std::invalid_argument if one of the queries is malformed
+    BatchPlan PlanBatch(const std::vector<std::string>& raw_queries) const;
+    // Distinct plus words of the queries plans[0, plan_count), in the order their scores are summed
+    static void GetBatchTerms(const QueryPlan* plans, size_t plan_count, std::vector<BatchTerm>& terms, std::vector<size_t>& term_queries);
+    // Scores the chunk queries plans[0, plan_count) over range; returns the hits of the queries with candidates there
+    template <typename ScoringModel>
+    std::vector<BatchQueryHits> SearchBatchRange(const QueryPlan* plans, size_t plan_count, const std::vector<BatchTerm>& terms,
+        const std::vector<size_t>& term_queries, const SegmentRange& range) const;
+    // Lays the hits of the distinct queries out query after query
+    static void WriteBatchHits(const BatchPlan& batch, const std::vector<std::array<SearchHit, MAX_RESULT_DOCUMENT_COUNT>>& unique_hits,
+        const std::vector<size_t>& unique_hit_counts, std::vector<SearchHit>& hits, std::vector<size_t>& hit_offsets);
+    // bits must not be 0
+    static int FindLowestSetBit(uint64_t bits);
+
+    QueryPlan PlanQuery(const Query& query) const;
+    static std::vector<SegmentRange> SplitIntoRanges(const SegmentList& segments, int range_documents);
+
+    // Adds the best hits of range to hits[0, hit_count)
+    template <typename ScoringModel, typename DocumentPredicate>
+    void SearchSegmentRange(const QueryPlan& plan, const SegmentRange& range, DocumentPredicate document_predicate,
+        SearchHit* hits, size_t& hit_count, size_t hit_capacity) const;
+
+    template <typename ScoringModel, typename DocumentPredicate>
+    size_t FindTopHits(const Query& query, DocumentPredicate document_predicate, SearchHit* hits, size_t hit_capacity) const;
+    template <typename ScoringModel, typename DocumentPredicate, typename ExecutionPolicy>
+    size_t FindTopHits(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, SearchHit* hits, size_t hit_capacity) const;
 };
 
 template <typename StringContainer>
 SearchServer::SearchServer(const StringContainer& stop_words)
 {
-    stop_words_ = MakeUniqueNonEmptyStrings(stop_words);
+    const auto unique_stop_words = MakeUniqueNonEmptyStrings(stop_words);
+    stop_words_.insert(unique_stop_words.begin(), unique_stop_words.end());
     if (!all_of(stop_words_.begin(), stop_words_.end(), IsValidWord)) {
         using namespace std;
         throw std::invalid_argument("Some of stop words are invalid"s);
@@ -105,173 +497,446 @@ SearchServer::SearchServer(std::string_view stop_words_text)
 {
 }
 
-template <typename DocumentPredicate>
+template <typename ScoringModel, typename DocumentPredicate>
 std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate) const {
-    const auto query = ParseQuery(raw_query.data());
+    if constexpr (std::is_same_v<DocumentPredicate, DocumentStatus>) {
+        return FindTopDocuments<ScoringModel>(raw_query, StatusIs{ document_predicate });
+    }
+    else {
+        std::array<SearchHit, MAX_RESULT_DOCUMENT_COUNT> hits;
+        const size_t hit_count = FindTopDocuments<ScoringModel>(raw_query, document_predicate, hits.data(), hits.size());
+        return std::vector<Document>(hits.begin(), hits.begin() + hit_count);
+    }
+}
 
-    auto matched_documents = FindAllDocuments(query, document_predicate);
+template <typename ScoringModel>
+std::vector<Document> SearchServer::FindTopDocuments(std::string_view raw_query) const {
+    return FindTopDocuments<ScoringModel>(raw_query, StatusIs{ DocumentStatus::ACTUAL });
+}
 
-    std::sort(matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < 1e-6) {
-            return lhs.rating > rhs.rating;
-        }
-        else {
-            return lhs.relevance > rhs.relevance;
-        }
-        });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+template <typename ScoringModel, typename DocumentPredicate>
+size_t SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, SearchHit* hits, size_t hit_capacity) const {
+    if constexpr (std::is_same_v<DocumentPredicate, DocumentStatus>) {
+        return FindTopDocuments<ScoringModel>(raw_query, StatusIs{ document_predicate }, hits, hit_capacity);
+    }
+    else {
+        const ReadLock lock(*this);
+        const auto query = ParseQuery(std::string(raw_query));
+        return FindTopHits<ScoringModel>(query, document_predicate, hits, hit_capacity);
     }
+}
 
-    return matched_documents;
+template <typename ScoringModel, typename DocumentPredicate>
+void SearchServer::FindTopDocuments(std::string_view raw_query, DocumentPredicate document_predicate, std::vector<SearchHit>& hits) const {
+    hits.resize(MAX_RESULT_DOCUMENT_COUNT);
+    hits.resize(FindTopDocuments<ScoringModel>(raw_query, document_predicate, hits.data(), hits.size()));
 }
 
-template <typename DocumentPredicate>
-std::vector<Document> SearchServer::FindAllDocuments(const Query& query, DocumentPredicate document_predicate) const {
-    std::map<int, double> document_to_relevance;
-    for (const std::string word : query.plus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
-        }
-        const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-        for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-            const auto& document_data = documents_.at(document_id);
-            if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                document_to_relevance[document_id] += term_freq * inverse_document_freq;
-            }
+template <typename ScoringModel, typename DocumentPredicate>
+void SearchServer::SearchSegmentRange(const QueryPlan& plan, const SegmentRange& range, DocumentPredicate document_predicate,
+    SearchHit* hits, size_t& hit_count, size_t hit_capacity) const {
+    if (hit_capacity == 0) {
+        return;
+    }
+    const IndexSegment& segment = *range.segment;
+    // One cursor per plus word in plan order, so every document's score is summed in that order
+    struct TermCursor {
+        PostingList postings;
+        const Posting* position;
+        double inverse_document_freq;
+        double max_score;
+    };
+    std::vector<TermCursor> cursors;
+    cursors.reserve(plan.plus_terms.size());
+    for (const PlannedTerm& term : plan.plus_terms) {
+        const PostingList postings = segment.GetPostings(term.term_id).Slice(range.first_index, range.last_index);
+        if (!postings.empty()) {
+            cursors.push_back({ postings, postings.begin(), term.inverse_document_freq,
+                ScoringModel::MaxScore(postings.GetMaxTermFreq(), term.inverse_document_freq) });
         }
     }
-    for (const std::string word : query.minus_words) {
-        if (word_to_document_freqs_.count(word) == 0) {
-            continue;
+    if (cursors.empty()) {
+        return;
+    }
+
+    // MaxScore: by_bound orders the cursors by their score bound, and bound_sums[k] is the sum of the first k bounds.
+    // Once the top list is full, the first non_essential cursors together can't lift a document into it, so only
+    // the others propose candidates and these are sought just for candidates that still can make it.
+    // The threshold keeps 1e-6 more than InsertTopHit's tie margin, so rounding can't drop a document it would take
+    const size_t cursor_count = cursors.size();
+    std::vector<size_t> by_bound(cursor_count);
+    std::iota(by_bound.begin(), by_bound.end(), 0);
+    std::sort(by_bound.begin(), by_bound.end(), [&cursors](size_t lhs, size_t rhs) {
+        return cursors[lhs].max_score < cursors[rhs].max_score;
+        });
+    std::vector<double> bound_sums(cursor_count + 1, 0.0);
+    std::vector<bool> is_essential(cursor_count, true);
+    for (size_t k = 0; k < cursor_count; ++k) {
+        bound_sums[k + 1] = bound_sums[k] + cursors[by_bound[k]].max_score;
+    }
+    double threshold = -std::numeric_limits<double>::infinity();
+    size_t non_essential = 0;
+    const auto update_threshold = [&] {
+        if (hit_count < hit_capacity) {
+            return;
+        }
+        threshold = hits[hit_capacity - 1].relevance - 2e-6;
+        non_essential = 0;
+        while (non_essential < cursor_count && bound_sums[non_essential + 1] < threshold) {
+            ++non_essential;
         }
-        for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-            document_to_relevance.erase(document_id);
+        for (size_t k = 0; k < cursor_count; ++k) {
+            is_essential[by_bound[k]] = k >= non_essential;
         }
+    };
+    update_threshold();
+
+    size_t candidate_count = 0;
+    for (const TermCursor& cursor : cursors) {
+        candidate_count += cursor.postings.size();
     }
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+    const ExcludedDocuments excluded_documents(plan, range, candidate_count);
+    // An attribute predicate is checked before anything is scored, any other one after the bound check
+    constexpr bool is_attribute_predicate = is_attribute_predicate_v<DocumentPredicate>;
+    std::optional<EligibleDocuments<DocumentPredicate>> eligible_documents;
+    if constexpr (is_attribute_predicate) {
+        eligible_documents.emplace(range, document_predicate);
     }
-    return matched_documents;
-}
-
-template <typename DocumentPredicate, typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindAllDocuments(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate) const
-{
-    if(policy == std::execution::seq) 
-        return FindAllDocuments(query, document_predicate);
-    std::map<int, double> document_to_relevance;
- 
-    auto plus = std::async(std::launch::async, [&query, &document_to_relevance, &word_to_document_freqs_, document_predicate]() {
-        for_each(std::execution::par, query.plus_words.begin(), query.plus_words.end(), [&document_to_relevance, &word_to_document_freqs_, document_predicate](std::string& word) {
-            if (word_to_document_freqs_.count(word) == 0) {
-                continue;
+    const double average_document_length = GetAverageDocumentLength();
+    std::vector<double> term_scores(cursor_count);
+    int next_index = range.first_index;
+    while (true) {
+        // Documents come in index order: the next one is the smallest under an essential cursor.
+        // A cursor that was non-essential may lag behind and is caught up first
+        int document_index = INT_MAX;
+        for (size_t i = 0; i < cursor_count; ++i) {
+            TermCursor& cursor = cursors[i];
+            if (is_essential[i]) {
+                cursor.position = cursor.postings.Seek(cursor.position, next_index);
+                if (cursor.position != cursor.postings.end()) {
+                    document_index = std::min(document_index, cursor.position->document_index);
+                }
             }
-            const double inverse_document_freq = ComputeWordInverseDocumentFreq(word);
-            for (const auto [document_id, term_freq] : word_to_document_freqs_.at(word)) {
-                const auto& document_data = documents_.at(document_id);
-                if (document_predicate(document_id, document_data.status, document_data.rating)) {
-                    document_to_relevance[document_id] += term_freq * inverse_document_freq;
+        }
+        if (document_index == INT_MAX) {
+            break;
+        }
+        next_index = document_index + 1;
+        const SegmentDocument& document = segment.GetDocument(document_index);
+        bool is_eligible = !segment.IsDeleted(document_index);
+        if constexpr (is_attribute_predicate) {
+            is_eligible = eligible_documents->Contains(document_index);
+        }
+        // The essential lists' scores, plus the bound of the rest
+        double bound = bound_sums[non_essential];
+        for (size_t i = 0; i < cursor_count; ++i) {
+            TermCursor& cursor = cursors[i];
+            term_scores[i] = 0.0;
+            if (is_essential[i] && cursor.position != cursor.postings.end() && cursor.position->document_index == document_index) {
+                if (is_eligible) {
+                    term_scores[i] = ScoringModel::Score(cursor.position->term_freq, cursor.inverse_document_freq, document.word_count, average_document_length);
+                    bound += term_scores[i];
                 }
+                ++cursor.position;
             }
-        });
-    });
-    auto minus = std::async(std::launch::async, [&query, &document_to_relevance]() {
-        for (const std::string word : query.minus_words) {
-            if (word_to_document_freqs_.count(word) == 0) {
+        }
+        if (!is_eligible || bound < threshold || excluded_documents.Contains(document_index)) {
+            continue;
+        }
+        if constexpr (!is_attribute_predicate) {
+            if (!document_predicate(document.id, document.status, document.rating)) {
                 continue;
             }
-            for (const auto [document_id, _] : word_to_document_freqs_.at(word)) {
-                document_to_relevance.erase(document_id);
+        }
+        double relevance = 0.0;
+        for (size_t i = 0; i < cursor_count; ++i) {
+            TermCursor& cursor = cursors[i];
+            if (!is_essential[i]) {
+                cursor.position = cursor.postings.Seek(cursor.position, document_index);
+                if (cursor.position != cursor.postings.end() && cursor.position->document_index == document_index) {
+                    term_scores[i] = ScoringModel::Score(cursor.position->term_freq, cursor.inverse_document_freq, document.word_count, average_document_length);
+                    ++cursor.position;
+                }
             }
+            relevance += term_scores[i];
         }
-    });
-    plus.get();
-    minus.get();
-    std::vector<Document> matched_documents;
-    for (const auto [document_id, relevance] : document_to_relevance) {
-        matched_documents.push_back({ document_id, relevance, documents_.at(document_id).rating });
+        InsertTopHit({ document.id, relevance, document.rating }, hits, hit_count, hit_capacity);
+        update_threshold();
     }
-    return matched_documents;
+}
 
+template <typename ScoringModel, typename DocumentPredicate>
+size_t SearchServer::FindTopHits(const Query& query, DocumentPredicate document_predicate, SearchHit* hits, size_t hit_capacity) const {
+    hit_capacity = std::min(hit_capacity, static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+    if (hit_capacity == 0) {
+        return 0;
+    }
+    const auto segments = GetSegments();
+    const QueryPlan plan = PlanQuery(query);
+    size_t hit_count = 0;
+    for (const auto& segment : *segments) {
+        SearchSegmentRange<ScoringModel>(plan, { segment.get(), 0, static_cast<int>(segment->GetDocumentCount()) }, document_predicate,
+            hits, hit_count, hit_capacity);
+    }
+    return hit_count;
 }
 
-template <typename DocumentPredicate, typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate document_predicate) const
+template <typename ScoringModel, typename DocumentPredicate, typename ExecutionPolicy>
+size_t SearchServer::FindTopHits(ExecutionPolicy&& policy, const Query& query, DocumentPredicate document_predicate, SearchHit* hits, size_t hit_capacity) const
 {
-    if (policy == std::execution::seq);
-        return FindTopDocuments(raw_query, document_predicate);
-    const auto query = ParseQuery(raw_query.data());
-    auto matched_documents = FindAllDocuments(query, document_predicate);
-
-    std::sort(std::execution::par, matched_documents.begin(), matched_documents.end(), [](const Document& lhs, const Document& rhs) {
-        if (std::abs(lhs.relevance - rhs.relevance) < 1e-6) {
-              return lhs.rating > rhs.rating;
+    if constexpr (std::is_same_v<std::decay_t<ExecutionPolicy>, std::execution::sequenced_policy>) {
+        return FindTopHits<ScoringModel>(query, document_predicate, hits, hit_capacity);
+    }
+    else {
+        // Every range keeps its own top hits; they are merged in range order afterwards
+        hit_capacity = std::min(hit_capacity, static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT));
+        if (hit_capacity == 0) {
+            return 0;
         }
-        else {
-             return lhs.relevance > rhs.relevance;
+        const auto segments = GetSegments();
+        const QueryPlan plan = PlanQuery(query);
+        const std::vector<SegmentRange> ranges = SplitIntoRanges(*segments, PARALLEL_RANGE_DOCUMENTS);
+        std::vector<std::array<SearchHit, MAX_RESULT_DOCUMENT_COUNT>> range_hits(ranges.size());
+        std::vector<size_t> range_hit_counts(ranges.size(), 0);
+        ForEachIndex(policy, ranges.size(), [&](size_t range_index) {
+            SearchSegmentRange<ScoringModel>(plan, ranges[range_index], document_predicate,
+                range_hits[range_index].data(), range_hit_counts[range_index], hit_capacity);
+            });
+
+        size_t hit_count = 0;
+        for (size_t range_index = 0; range_index < ranges.size(); ++range_index) {
+            for (size_t i = 0; i < range_hit_counts[range_index]; ++i) {
+                InsertTopHit(range_hits[range_index][i], hits, hit_count, hit_capacity);
+            }
         }
-    });
-    if (matched_documents.size() > MAX_RESULT_DOCUMENT_COUNT) {
-        matched_documents.resize(MAX_RESULT_DOCUMENT_COUNT);
+        return hit_count;
     }
-    return matched_documents;
 }
 
-template <typename ExecutionPolicy>
-std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentStatus status) const
+template <typename ScoringModel, typename DocumentPredicate, typename ExecutionPolicy>
+std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query, DocumentPredicate document_predicate) const
 {
-    if (policy == std::execution::seq);
-        return FindTopDocuments(raw_query, status);
-    return FindTopDocuments(policy, raw_query, [status](int document_id, DocumentStatus document_status, int rating) {
-        return document_status == status;
-    });
+    if constexpr (std::is_same_v<DocumentPredicate, DocumentStatus>) {
+        return FindTopDocuments<ScoringModel>(policy, raw_query, StatusIs{ document_predicate });
+    }
+    else {
+        const ReadLock lock(*this);
+        const auto query = ParseQuery(std::string(raw_query));
+        std::array<SearchHit, MAX_RESULT_DOCUMENT_COUNT> hits;
+        const size_t hit_count = FindTopHits<ScoringModel>(policy, query, document_predicate, hits.data(), hits.size());
+        return std::vector<Document>(hits.begin(), hits.begin() + hit_count);
+    }
 }
 
-template <typename ExecutionPolicy>
+template <typename ScoringModel, typename ExecutionPolicy>
 std::vector<Document> SearchServer::FindTopDocuments(ExecutionPolicy&& policy, const std::string_view raw_query) const
 {
-    if (policy == std::execution::seq);
-        return FindTopDocuments(raw_query);
-    return FindTopDocuments(policy, raw_query, DocumentStatus::ACTUAL);
+    return FindTopDocuments<ScoringModel>(policy, raw_query, StatusIs{ DocumentStatus::ACTUAL });
 }
 
-template <typename ExecutionPolicy>
-std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::string_view raw_query, int document_id, ExecutionPolicy&& policy)
-{
-    const auto query = ParseQuery(raw_query.data());
-
-    matched_words_.clear();
-    std::vector<std::string_view> matched_words_view;
-    for_each(policy, query.plus_words.begin(), query.plus_words.end(), [&](const std::string word)
-        {
-            if (word_to_document_freqs_.at(word).count(document_id)) {
-                matched_words_.push_back(word);
+template <typename ScoringModel>
+std::vector<std::vector<Document>> SearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries, LimitedThreadPool thread_pool) const {
+    std::vector<SearchHit> hits;
+    std::vector<size_t> hit_offsets;
+    FindTopDocumentsBatch<ScoringModel>(raw_queries, hits, hit_offsets, thread_pool);
+    std::vector<std::vector<Document>> results(raw_queries.size());
+    for (size_t i = 0; i < raw_queries.size(); ++i) {
+        results[i] = std::vector<Document>(hits.begin() + hit_offsets[i], hits.begin() + hit_offsets[i + 1]);
+    }
+    return results;
+}
+
+template <typename ScoringModel>
+void SearchServer::FindTopDocumentsBatch(const std::vector<std::string>& raw_queries, std::vector<SearchHit>& hits, std::vector<size_t>& hit_offsets,
+    LimitedThreadPool thread_pool) const {
+    const ReadLock lock(*this);
+    const BatchPlan batch = PlanBatch(raw_queries);
+    const auto segments = GetSegments();
+    const std::vector<SegmentRange> ranges = SplitIntoRanges(*segments, PARALLEL_RANGE_DOCUMENTS);
+    std::vector<std::array<SearchHit, MAX_RESULT_DOCUMENT_COUNT>> unique_hits(batch.plans.size());
+    std::vector<size_t> unique_hit_counts(batch.plans.size(), 0);
+
+    std::vector<BatchTerm> terms;
+    std::vector<size_t> term_queries;
+    std::vector<std::vector<BatchQueryHits>> range_hits(ranges.size());
+    for (size_t chunk_first = 0; chunk_first < batch.plans.size(); chunk_first += BATCH_CHUNK_QUERIES) {
+        const QueryPlan* const chunk_plans = batch.plans.data() + chunk_first;
+        const size_t chunk_size = std::min(BATCH_CHUNK_QUERIES, batch.plans.size() - chunk_first);
+        GetBatchTerms(chunk_plans, chunk_size, terms, term_queries);
+        if (terms.empty()) {
+            continue;
+        }
+        thread_pool.ParallelFor(ranges.size(), [&](size_t range_index) {
+            range_hits[range_index] = SearchBatchRange<ScoringModel>(chunk_plans, chunk_size, terms, term_queries, ranges[range_index]);
+            });
+        // Ranges are merged in order, as in the parallel FindTopDocuments
+        for (const auto& query_hits_list : range_hits) {
+            for (const BatchQueryHits& query_hits : query_hits_list) {
+                const size_t query_index = chunk_first + query_hits.query_index;
+                for (size_t i = 0; i < query_hits.hit_count; ++i) {
+                    InsertTopHit(query_hits.hits[i], unique_hits[query_index].data(), unique_hit_counts[query_index], MAX_RESULT_DOCUMENT_COUNT);
+                }
             }
-        });
-    for_each(policy, query.minus_words.begin(), query.minus_words.end(), [&](const std::string word)
-        {
-            if (word_to_document_freqs_.at(word).count(document_id)) {
-                matched_words_.clear();
+        }
+    }
+    WriteBatchHits(batch, unique_hits, unique_hit_counts, hits, hit_offsets);
+}
+
+template <typename ScoringModel>
+std::vector<SearchServer::BatchQueryHits> SearchServer::SearchBatchRange(const QueryPlan* plans, size_t plan_count, const std::vector<BatchTerm>& terms,
+    const std::vector<size_t>& term_queries, const SegmentRange& range) const {
+    const IndexSegment& segment = *range.segment;
+    // next_index caches the position's document index (INT_MAX at the end), so skipping
+    // a term with nothing in the block doesn't touch its postings
+    struct TermCursor {
+        const BatchTerm* term;
+        PostingList postings;
+        const Posting* position;
+        int next_index;
+    };
+    std::vector<TermCursor> cursors;
+    for (const BatchTerm& term : terms) {
+        const PostingList postings = segment.GetPostings(term.term_id).Slice(range.first_index, range.last_index);
+        if (!postings.empty()) {
+            cursors.push_back({ &term, postings, postings.begin(), postings.begin()->document_index });
+        }
+    }
+    std::vector<BatchQueryHits> results;
+    if (cursors.empty()) {
+        return results;
+    }
+
+    constexpr int BLOCK_WORDS = BATCH_BLOCK_DOCUMENTS / 64;
+    // Queries scored in the current block get consecutive slots: scores[slot * BATCH_BLOCK_DOCUMENTS + i] is
+    // the score of the block's document i and bit i of touched[slot * BLOCK_WORDS, ...) says whether it has one
+    std::vector<int> block_slots(plan_count, -1);
+    std::vector<size_t> block_queries;
+    std::vector<double> scores;
+    std::vector<uint64_t> touched;
+    // Entry of each query in results and its minus words, made at its first candidate in the range
+    std::vector<int> result_slots(plan_count, -1);
+    std::vector<ExcludedDocuments> excluded_documents;
+
+    // A term's score in each block document that has it, computed once for all the queries containing it.
+    // A term has at most one posting per document, so a block holds at most BATCH_BLOCK_DOCUMENTS of them
+    int term_offsets[BATCH_BLOCK_DOCUMENTS];
+    double term_scores[BATCH_BLOCK_DOCUMENTS];
+    const double average_document_length = GetAverageDocumentLength();
+    // Bit i says the block's document i can be returned: it's live and ACTUAL
+    uint64_t eligible[BLOCK_WORDS];
+    for (int block_first = range.first_index; block_first < range.last_index; block_first += BATCH_BLOCK_DOCUMENTS) {
+        const int block_last = std::min(block_first + BATCH_BLOCK_DOCUMENTS, range.last_index);
+        std::fill(eligible, eligible + BLOCK_WORDS, 0);
+        for (int document_index = block_first; document_index < block_last; ++document_index) {
+            if (!segment.IsDeleted(document_index) && segment.GetDocument(document_index).status == DocumentStatus::ACTUAL) {
+                const int offset = document_index - block_first;
+                eligible[offset / 64] |= uint64_t(1) << (offset % 64);
             }
-        });
-    for (std::string s : matched_words_)
-        matched_words_view.push_back(s);
-    return { matched_words_view, documents_.at(document_id).status };
+        }
+        for (TermCursor& cursor : cursors) {
+            if (cursor.next_index >= block_last) {
+                continue;
+            }
+            const Posting* const block_end = cursor.postings.Seek(cursor.position, block_last);
+            const int term_count = static_cast<int>(block_end - cursor.position);
+            for (int j = 0; j < term_count; ++j) {
+                const Posting& posting = cursor.position[j];
+                const int document_length = ScoringModel::uses_document_length ? segment.GetDocument(posting.document_index).word_count : 0;
+                term_offsets[j] = posting.document_index - block_first;
+                term_scores[j] = ScoringModel::Score(posting.term_freq, cursor.term->inverse_document_freq, document_length, average_document_length);
+            }
+            for (size_t i = cursor.term->first_query; i < cursor.term->last_query; ++i) {
+                const size_t query_index = term_queries[i];
+                int& slot = block_slots[query_index];
+                if (slot < 0) {
+                    slot = static_cast<int>(block_queries.size());
+                    block_queries.push_back(query_index);
+                    if (scores.size() < block_queries.size() * BATCH_BLOCK_DOCUMENTS) {
+                        scores.resize(block_queries.size() * BATCH_BLOCK_DOCUMENTS, 0.0);
+                        touched.resize(block_queries.size() * BLOCK_WORDS, 0);
+                    }
+                }
+                double* const query_scores = scores.data() + static_cast<size_t>(slot) * BATCH_BLOCK_DOCUMENTS;
+                uint64_t* const query_touched = touched.data() + static_cast<size_t>(slot) * BLOCK_WORDS;
+                for (int j = 0; j < term_count; ++j) {
+                    query_scores[term_offsets[j]] += term_scores[j];
+                    query_touched[term_offsets[j] / 64] |= uint64_t(1) << (term_offsets[j] % 64);
+                }
+            }
+            cursor.position = block_end;
+            cursor.next_index = block_end == cursor.postings.end() ? INT_MAX : block_end->document_index;
+        }
+
+        // Collect the block's candidates and leave the scratch arrays zeroed for the next block
+        for (size_t slot = 0; slot < block_queries.size(); ++slot) {
+            const size_t query_index = block_queries[slot];
+            block_slots[query_index] = -1;
+            double* const query_scores = scores.data() + slot * BATCH_BLOCK_DOCUMENTS;
+            uint64_t* const query_touched = touched.data() + slot * BLOCK_WORDS;
+            for (int word = 0; word < BLOCK_WORDS; ++word) {
+                for (uint64_t bits = query_touched[word]; bits != 0; bits &= bits - 1) {
+                    const int offset = word * 64 + FindLowestSetBit(bits);
+                    const double relevance = query_scores[offset];
+                    query_scores[offset] = 0.0;
+                    if ((eligible[word] & (uint64_t(1) << (offset % 64))) == 0) {
+                        continue;
+                    }
+                    int& result_slot = result_slots[query_index];
+                    if (result_slot < 0) {
+                        result_slot = static_cast<int>(results.size());
+                        results.push_back({ query_index, 0, {} });
+                        size_t candidate_count = 0;
+                        for (const PlannedTerm& term : plans[query_index].plus_terms) {
+                            candidate_count += segment.GetPostings(term.term_id).Slice(range.first_index, range.last_index).size();
+                        }
+                        excluded_documents.emplace_back(plans[query_index], range, candidate_count);
+                    }
+                    BatchQueryHits& query_hits = results[result_slot];
+                    // Most candidates lose to the hits found so far; InsertTopHit would drop them too
+                    if (query_hits.hit_count == MAX_RESULT_DOCUMENT_COUNT && relevance < query_hits.hits.back().relevance - 1e-6) {
+                        continue;
+                    }
+                    const int document_index = block_first + offset;
+                    if (!excluded_documents[result_slot].Contains(document_index)) {
+                        const SegmentDocument& document = segment.GetDocument(document_index);
+                        InsertTopHit({ document.id, relevance, document.rating }, query_hits.hits.data(), query_hits.hit_count, MAX_RESULT_DOCUMENT_COUNT);
+                    }
+                }
+                query_touched[word] = 0;
+            }
+        }
+        block_queries.clear();
+    }
+    return results;
+}
+
+template <typename ExecutionPolicy>
+std::tuple<std::vector<std::string_view>, DocumentStatus> SearchServer::MatchDocument(const std::string_view raw_query, int document_id, ExecutionPolicy&& policy) const
+{
+    // Each query word costs one binary search in the document's forward entry,
+    // far too little work to be worth splitting across threads
+    return MatchDocument(raw_query, document_id);
 }
 
 template <typename ExecutionPolicy>
 void SearchServer::RemoveDocument(ExecutionPolicy&& policy, int document_id) {
-    document_to_word_freqs_.erase(document_id);
+    const std::unique_lock lock(index_mutex_);
+    if (document_ids_.count(document_id) == 0) {
+        return;
+    }
+    if (write_ahead_log_) {
+        log_sequence_ = write_ahead_log_->LogRemoveDocument(document_id);
+    }
 
-    for_each(policy, word_to_document_freqs_.begin(), word_to_document_freqs_.end(), [&](auto& w) {
-        int t = w.second.count(document_id);
-        if (t) {
-            w.second.erase(document_id);
-        }
-        });
-    documents_.erase(document_id);
+    // The postings stay in the segment under a tombstone until a merge drops them;
+    // only the live document counts of the document's own words change. They are updated on this
+    // thread whatever the policy: a thread waiting for the pool runs queued tasks, and a query among
+    // them would wait for the lock held here
+    const DocumentLocation location = MarkDocumentDeleted(document_id);
+    const auto [first, last] = location.segment->GetTermFreqs(location.document_index);
+    for (const TermFrequency* term_freq = first; term_freq != last; ++term_freq) {
+        --term_document_counts_[term_freq->term_id];
+    }
+    total_word_count_ -= location.segment->GetDocument(location.document_index).word_count;
     document_ids_.erase(document_id);
-
 }
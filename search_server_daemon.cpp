@@ -0,0 +1,109 @@
+// search_server daemon: indexes a corpus and serves it through QueryServer.
+//
+// search_server_daemon --corpus FILE [--format lines|framed] [--stop-words "a the"] [--tcp [HOST:]PORT] [--unix PATH] [--workers N] [--pin-cpus FIRST_CPU]
+//
+// The corpus is read with IngestCorpus, see corpus_ingest.h for both formats.
+// Requests run on one ThreadPool of --workers threads, pinned to consecutive allowed CPUs
+// starting at FIRST_CPU when --pin-cpus is given.
+
+#include <csignal>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include "corpus_ingest.h"
+#include "query_server.h"
+#include "search_server.h"
+#include "thread_pool.h"
+
+using namespace std;
+
+namespace {
+QueryServer* running_server = nullptr;
+
+void HandleStopSignal(int) {
+    if (running_server) {
+        running_server->Stop();
+    }
+}
+
+void PrintUsage() {
+    cerr << "Usage: search_server_daemon --corpus FILE [--format lines|framed] [--stop-words \"WORDS\"] [--tcp [HOST:]PORT] [--unix PATH] [--workers N] [--pin-cpus FIRST_CPU]"s << endl;
+}
+}
+
+int main(int argc, char* argv[]) {
+    string corpus_path;
+    IngestOptions ingest_options;
+    string stop_words;
+    string tcp_address;
+    string unix_path;
+    ThreadPoolOptions pool_options;
+
+    for (int i = 1; i < argc; ++i) {
+        const string option = argv[i];
+        if (i + 1 >= argc) {
+            PrintUsage();
+            return 2;
+        }
+        const string value = argv[++i];
+        if (option == "--corpus"s) {
+            corpus_path = value;
+        }
+        else if (option == "--format"s && (value == "lines"s || value == "framed"s)) {
+            ingest_options.format = value == "lines"s ? CorpusFormat::LINES : CorpusFormat::FRAMED;
+        }
+        else if (option == "--stop-words"s) {
+            stop_words = value;
+        }
+        else if (option == "--tcp"s) {
+            tcp_address = value;
+        }
+        else if (option == "--unix"s) {
+            unix_path = value;
+        }
+        else if (option == "--workers"s) {
+            pool_options.thread_count = stoul(value);
+        }
+        else if (option == "--pin-cpus"s) {
+            pool_options.pin_to_cpus = true;
+            pool_options.first_cpu = stoul(value);
+        }
+        else {
+            PrintUsage();
+            return 2;
+        }
+    }
+    if (corpus_path.empty() || (tcp_address.empty() && unix_path.empty())) {
+        PrintUsage();
+        return 2;
+    }
+
+    try {
+        SearchServer search_server(stop_words);
+        const IngestStats stats = IngestCorpus(corpus_path, search_server, ingest_options);
+        cerr << "Indexed "s << stats.indexed_documents << " documents, skipped "s << stats.skipped_documents << endl;
+
+        ThreadPool thread_pool(pool_options);
+        QueryServer server(search_server, thread_pool);
+        if (!tcp_address.empty()) {
+            const size_t colon = tcp_address.rfind(':');
+            const string host = colon == string::npos ? ""s : tcp_address.substr(0, colon);
+            const string port = colon == string::npos ? tcp_address : tcp_address.substr(colon + 1);
+            server.ListenTcp(host, static_cast<uint16_t>(stoul(port)));
+        }
+        if (!unix_path.empty()) {
+            server.ListenUnix(unix_path);
+        }
+
+        running_server = &server;
+        signal(SIGINT, HandleStopSignal);
+        signal(SIGTERM, HandleStopSignal);
+        server.Run();
+        running_server = nullptr;
+    }
+    catch (const exception& e) {
+        cerr << "search_server_daemon: "s << e.what() << endl;
+        return 1;
+    }
+    return 0;
+}
@@ -21,6 +21,20 @@ std::vector<std::string> SplitIntoWords(const std::string_view text) {
 
     return words;
 }
+std::vector<std::string_view> SplitIntoWordsView(std::string_view text) {
+    std::vector<std::string_view> words;
+    size_t word_begin = 0;
+    for (size_t i = 0; i <= text.size(); ++i) {
+        if (i == text.size() || text[i] == ' ') {
+            if (i > word_begin) {
+                words.push_back(text.substr(word_begin, i - word_begin));
+            }
+            word_begin = i + 1;
+        }
+    }
+    return words;
+}
+
 bool HasSpecialSymbols(const std::string& text) {
     for (char c : text) {
         if (c >= '\x0' && c < '\x20') return true;
@@ -12,6 +12,8 @@
 #define LARGE_INDEX "index is more than a documents count"s
 
 std::vector<std::string> SplitIntoWords(const std::string_view text);
+// Same split, but the words point into text instead of being copied
+std::vector<std::string_view> SplitIntoWordsView(std::string_view text);
 
 template<typename StringContainer>
 std::set<std::string> MakeUniqueNonEmptyStrings(StringContainer strings) {
@@ -1 +1,915 @@
-#include "test_example_functions.h"
\ No newline at end of file
+#include "test_example_functions.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "corpus_ingest.h"
+#include "query_scheduler.h"
+#ifdef __linux__
+#include "query_server.h"
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+#include "remove_duplicates.h"
+#include "request_queue.h"
+#include "search_server.h"
+#include "thread_pool.h"
+#include "write_ahead_log.h"
+
+using namespace std;
+
+namespace {
+void AssertImpl(bool value, const string& expr, const string& file, unsigned line) {
+    if (!value) {
+        cerr << file << "("s << line << "): ASSERT("s << expr << ") failed."s << endl;
+        abort();
+    }
+}
+
+#define ASSERT(expr) AssertImpl(!!(expr), #expr, __FILE__, __LINE__)
+
+const vector<string> TEST_DOCUMENTS = {
+    "funny pet and nasty rat"s,
+    "funny pet with curly hair"s,
+    "funny pet and not very nasty rat"s,
+    "pet with rat and rat and rat"s,
+    "nasty rat with curly hair"s,
+    "big dog with curly tail"s,
+    "small cat and big dog"s,
+    "nasty cat with very curly hair"s,
+};
+
+const vector<string> TEST_QUERIES = {
+    "nasty rat -not"s,
+    "not very funny nasty pet"s,
+    "curly hair"s,
+    "big dog -cat"s,
+    "rat cat dog pet"s,
+};
+
+// A path in the temporary directory that doesn't exist yet
+string MakeTemporaryPath(const string& name) {
+    const filesystem::path path = filesystem::temp_directory_path() / ("search_server_test_"s + name);
+    filesystem::remove(path);
+    return path.string();
+}
+
+void AddTestDocuments(SearchServer& search_server, int first_id, int last_id) {
+    for (int id = first_id; id < last_id; ++id) {
+        search_server.AddDocument(id, TEST_DOCUMENTS[id % TEST_DOCUMENTS.size()], DocumentStatus::ACTUAL, { id % 5, 2 });
+    }
+}
+
+bool HaveSameResults(const SearchServer& lhs, const SearchServer& rhs) {
+    if (lhs.GetDocumentCount() != rhs.GetDocumentCount()) {
+        return false;
+    }
+    for (const string& query : TEST_QUERIES) {
+        const vector<Document> lhs_documents = lhs.FindTopDocuments(query);
+        const vector<Document> rhs_documents = rhs.FindTopDocuments(query);
+        if (lhs_documents.size() != rhs_documents.size()) {
+            return false;
+        }
+        for (size_t i = 0; i < lhs_documents.size(); ++i) {
+            if (lhs_documents[i].id != rhs_documents[i].id || lhs_documents[i].rating != rhs_documents[i].rating
+                || abs(lhs_documents[i].relevance - rhs_documents[i].relevance) > 1e-9) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+}
+
+void TestWriteAheadLogReplay() {
+    const string log_path = MakeTemporaryPath("replay.log"s);
+    SearchServer expected("and with"s);
+    {
+        SearchServer search_server("and with"s);
+        WriteAheadLog log(log_path);
+        search_server.SetWriteAheadLog(&log);
+        AddTestDocuments(search_server, 0, 6);
+        search_server.RemoveDocument(2);
+        AddTestDocuments(search_server, 6, 8);
+    }
+    AddTestDocuments(expected, 0, 6);
+    expected.RemoveDocument(2);
+    AddTestDocuments(expected, 6, 8);
+
+    SearchServer recovered("and with"s);
+    ASSERT(ReplayWriteAheadLog(log_path, recovered) == 9);
+    ASSERT(recovered.GetLogSequence() == 9);
+    ASSERT(HaveSameResults(recovered, expected));
+
+    // A crash in the middle of the last record
+    const auto size = filesystem::file_size(log_path);
+    filesystem::resize_file(log_path, size - 5);
+    SearchServer torn("and with"s);
+    ASSERT(ReplayWriteAheadLog(log_path, torn) == 8);
+    ASSERT(torn.GetDocumentCount() == 6);
+
+    // Reopening cuts the torn record off, so the next record is readable and takes its number
+    {
+        WriteAheadLog log(log_path);
+        torn.SetWriteAheadLog(&log);
+        torn.AddDocument(7, TEST_DOCUMENTS[7], DocumentStatus::ACTUAL, { 7 % 5, 2 });
+        ASSERT(torn.GetLogSequence() == 9);
+    }
+    SearchServer reopened("and with"s);
+    ASSERT(ReplayWriteAheadLog(log_path, reopened) == 9);
+    ASSERT(HaveSameResults(reopened, expected));
+    filesystem::remove(log_path);
+}
+
+void TestSnapshotRecovery() {
+    const string log_path = MakeTemporaryPath("recovery.log"s);
+    const string snapshot_path = MakeTemporaryPath("recovery.snapshot"s);
+    const string old_log_path = MakeTemporaryPath("recovery_old.log"s);
+    SearchServer expected("and with"s);
+    AddTestDocuments(expected, 0, 40);
+    expected.RemoveDocument(3);
+    expected.RemoveDocument(25);
+    {
+        SearchServer search_server("and with"s);
+        search_server.SetSegmentOptions({ 8, 2, true });
+        WriteAheadLog log(log_path);
+        search_server.SetWriteAheadLog(&log);
+        AddTestDocuments(search_server, 0, 30);
+        search_server.RemoveDocument(3);
+        filesystem::copy_file(log_path, old_log_path);
+        search_server.SaveSnapshot(snapshot_path);
+        ASSERT(filesystem::file_size(log_path) == 0);
+        // Logged after the snapshot
+        AddTestDocuments(search_server, 30, 40);
+        search_server.RemoveDocument(25);
+    }
+
+    SearchServer recovered("and with"s);
+    ASSERT(RecoverIndex(snapshot_path, log_path, recovered) == 11);
+    ASSERT(HaveSameResults(recovered, expected));
+    ASSERT(recovered.GetLogSequence() == 42);
+
+    // A crash after the snapshot but before the log was truncated: the old records are skipped
+    SearchServer not_truncated("and with"s);
+    ASSERT(RecoverIndex(snapshot_path, old_log_path, not_truncated) == 0);
+    ASSERT(not_truncated.GetLogSequence() == 31);
+    ASSERT(not_truncated.GetDocumentCount() == 29);
+
+    // Loading only works on an empty server
+    try {
+        recovered.LoadSnapshot(snapshot_path);
+        ASSERT(false);
+    }
+    catch (const invalid_argument&) {
+    }
+
+    // A cut-off snapshot is rejected and leaves the server empty
+    filesystem::resize_file(snapshot_path, filesystem::file_size(snapshot_path) / 2);
+    SearchServer damaged("and with"s);
+    try {
+        damaged.LoadSnapshot(snapshot_path);
+        ASSERT(false);
+    }
+    catch (const runtime_error&) {
+    }
+    ASSERT(damaged.GetDocumentCount() == 0);
+
+    filesystem::remove(log_path);
+    filesystem::remove(snapshot_path);
+    filesystem::remove(old_log_path);
+}
+
+void TestSegmentMerges() {
+    SearchServer single("and with"s);
+    single.SetSegmentOptions({ 1000, 4, false });
+    SearchServer segmented("and with"s);
+    segmented.SetSegmentOptions({ 3, 2, false });
+    SearchServer merging("and with"s);
+    merging.SetSegmentOptions({ 3, 2, true });
+    for (SearchServer* search_server : { &single, &segmented, &merging }) {
+        AddTestDocuments(*search_server, 0, 50);
+        for (int id = 0; id < 50; id += 7) {
+            search_server->RemoveDocument(id);
+        }
+        // Added again after the removal, to a newer segment
+        AddTestDocuments(*search_server, 0, 1);
+    }
+    ASSERT(segmented.GetIndexStats().segment_count > 10);
+    ASSERT(HaveSameResults(single, segmented));
+    ASSERT(HaveSameResults(single, merging));
+    for (const string& query : TEST_QUERIES) {
+        const vector<Document> expected = single.FindTopDocuments(query);
+        const vector<Document> parallel = segmented.FindTopDocuments(execution::par, query);
+        ASSERT(expected.size() == parallel.size());
+        for (size_t i = 0; i < expected.size(); ++i) {
+            ASSERT(expected[i].id == parallel[i].id);
+        }
+        for (const int id : single) {
+            const auto [single_words, single_status] = single.MatchDocument(query, id);
+            const auto [segmented_words, segmented_status] = segmented.MatchDocument(query, id);
+            ASSERT(single_words == segmented_words && single_status == segmented_status);
+        }
+    }
+
+    // Sealing the mutable segment leaves views into it valid
+    using TermList = vector<pair<string_view, double>>;
+    const DocumentTermsView mutable_terms = single.GetWordFrequencies(0);
+    const TermList expected_terms(mutable_terms.begin(), mutable_terms.end());
+    single.MergeAllSegments();
+    ASSERT(TermList(mutable_terms.begin(), mutable_terms.end()) == expected_terms);
+    segmented.MergeAllSegments();
+    const IndexStats stats = segmented.GetIndexStats();
+    ASSERT(stats.segment_count == 1);
+    ASSERT(stats.deleted_document_count == 0);
+    ASSERT(HaveSameResults(single, segmented));
+    for (const int id : single) {
+        const auto single_terms = single.GetWordFrequencies(id);
+        const auto segmented_terms = segmented.GetWordFrequencies(id);
+        ASSERT(single_terms.size() == segmented_terms.size());
+    }
+}
+
+void TestIndexStats() {
+    SearchServer search_server("and"s);
+    search_server.SetSegmentOptions({ 4, 4, false });
+    search_server.AddDocument(0, "cat dog"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(1, "cat and bird"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(2, "cat fish fish"s, DocumentStatus::BANNED, { 1 });
+    search_server.AddDocument(3, "dog owl"s, DocumentStatus::ACTUAL, { 1 });
+    search_server.AddDocument(4, "ant"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT(search_server.GetPostingLength("cat"s) == 3);
+    ASSERT(search_server.GetPostingLength("fish"s) == 1);
+    ASSERT(search_server.GetPostingLength("and"s) == 0);
+    ASSERT(search_server.GetPostingLength("zebra"s) == 0);
+
+    // Posting lengths 3, 2, 1, 1, 1, 1; the first four documents filled a segment
+    IndexStats stats = search_server.GetIndexStats();
+    ASSERT(stats.document_count == 5 && stats.segment_count == 2 && stats.deleted_document_count == 0);
+    ASSERT(stats.term_count == 6 && stats.total_postings == 9);
+    ASSERT(stats.min_posting_length == 1 && stats.median_posting_length == 1 && stats.max_posting_length == 3);
+    ASSERT(stats.average_posting_length == 1.5);
+    ASSERT(stats.posting_length_histogram == vector<size_t>({ 0, 4, 2 }));
+    ASSERT(stats.dictionary_bytes > 0 && stats.inverted_index_bytes > 0 && stats.forward_index_bytes > 0 && stats.document_data_bytes > 0);
+
+    // Removed documents leave tombstones in both segments; their words drop out of the stats
+    // but stay in the dictionary
+    search_server.RemoveDocument(3);
+    search_server.RemoveDocument(4);
+    ASSERT(search_server.GetPostingLength("dog"s) == 1);
+    ASSERT(search_server.GetPostingLength("owl"s) == 0);
+    stats = search_server.GetIndexStats();
+    ASSERT(stats.document_count == 3 && stats.segment_count == 2 && stats.deleted_document_count == 2);
+    ASSERT(stats.term_count == 4 && stats.total_postings == 6);
+    ASSERT(stats.min_posting_length == 1 && stats.median_posting_length == 1 && stats.max_posting_length == 3);
+    ASSERT(stats.average_posting_length == 1.5);
+    ASSERT(stats.posting_length_histogram == vector<size_t>({ 2, 3, 1 }));
+
+    // The merge drops the tombstones, not the words
+    search_server.MergeAllSegments();
+    const IndexStats merged_stats = search_server.GetIndexStats();
+    ASSERT(merged_stats.segment_count == 1 && merged_stats.deleted_document_count == 0);
+    ASSERT(merged_stats.term_count == 4 && merged_stats.total_postings == 6);
+    ASSERT(merged_stats.posting_length_histogram == stats.posting_length_histogram);
+    ASSERT(merged_stats.inverted_index_bytes < stats.inverted_index_bytes);
+
+    // A word of removed documents only comes back with a new one
+    search_server.AddDocument(5, "owl owl"s, DocumentStatus::ACTUAL, { 1 });
+    ASSERT(search_server.GetPostingLength("owl"s) == 1);
+    stats = search_server.GetIndexStats();
+    ASSERT(stats.document_count == 4 && stats.term_count == 5 && stats.total_postings == 7);
+    ASSERT(stats.posting_length_histogram == vector<size_t>({ 1, 4, 1 }));
+}
+
+void TestBatchMatchesSingleQueries() {
+    mt19937 generator(29);
+    // Skewed word frequencies give both long and short posting lists
+    const auto random_word = [&generator] {
+        return "w"s + to_string(min(generator() % 400, generator() % 400));
+    };
+    SearchServer search_server("w0 w1"s);
+    search_server.SetSegmentOptions({ 700, 4, false });
+    for (int id = 0; id < 3000; ++id) {
+        string text;
+        for (int i = 3 + generator() % 12; i > 0; --i) {
+            text += random_word() + ' ';
+        }
+        const DocumentStatus status = id % 11 == 0 ? DocumentStatus::BANNED : DocumentStatus::ACTUAL;
+        search_server.AddDocument(id, text, status, { static_cast<int>(generator() % 3) });
+    }
+    for (int id = 0; id < 3000; id += 13) {
+        search_server.RemoveDocument(id);
+    }
+
+    // More distinct queries than one chunk holds, some of them repeated
+    vector<string> queries;
+    for (int i = 0; i < 2600; ++i) {
+        string query;
+        for (int j = 1 + generator() % 4; j > 0; --j) {
+            query += random_word() + ' ';
+        }
+        if (i % 3 == 0) {
+            query += '-' + random_word();
+        }
+        queries.push_back(query);
+    }
+    queries.insert(queries.end(), queries.begin(), queries.begin() + 100);
+
+    const auto are_equal = [](const vector<Document>& lhs, const vector<Document>& rhs) {
+        return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const Document& lhs_document, const Document& rhs_document) {
+            return lhs_document.id == rhs_document.id && lhs_document.rating == rhs_document.rating
+                && lhs_document.relevance == rhs_document.relevance;
+            });
+    };
+    ThreadPoolOptions pool_options;
+    pool_options.thread_count = 3;
+    ThreadPool thread_pool(pool_options);
+    const vector<vector<Document>> results = search_server.FindTopDocumentsBatch(queries, thread_pool);
+    const vector<vector<Document>> bm25_results = search_server.FindTopDocumentsBatch<Bm25Scoring<>>(queries, thread_pool);
+    ASSERT(results.size() == queries.size() && bm25_results.size() == queries.size());
+    for (size_t i = 0; i < queries.size(); ++i) {
+        ASSERT(are_equal(results[i], search_server.FindTopDocuments(queries[i])));
+        ASSERT(are_equal(bm25_results[i], search_server.FindTopDocuments<Bm25Scoring<>>(queries[i])));
+    }
+
+    // The parallel overloads and the scheduler take the scoring model too
+    QueryScheduler scheduler(search_server, chrono::microseconds(100), 64, thread_pool, Bm25Scoring<>{});
+    vector<future<vector<Document>>> scheduled;
+    for (size_t i = 0; i < 200; ++i) {
+        scheduled.push_back(scheduler.FindTopDocumentsAsync(queries[i]));
+    }
+    for (size_t i = 0; i < 200; ++i) {
+        ASSERT(are_equal(search_server.FindTopDocuments<Bm25Scoring<>>(thread_pool, queries[i]), bm25_results[i]));
+        ASSERT(are_equal(scheduled[i].get(), bm25_results[i]));
+    }
+
+    // A concurrency limit changes nothing but the number of threads
+    const vector<string> limited_queries(queries.begin(), queries.begin() + 200);
+    const vector<vector<Document>> limited_results = search_server.FindTopDocumentsBatch(limited_queries, thread_pool.Limit(2));
+    for (size_t i = 0; i < limited_queries.size(); ++i) {
+        ASSERT(are_equal(limited_results[i], results[i]));
+        ASSERT(are_equal(search_server.FindTopDocuments(thread_pool.Limit(1), limited_queries[i]), results[i]));
+    }
+    {
+        QueryScheduler limited_scheduler(search_server, chrono::microseconds(100), 64, thread_pool.Limit(1));
+        vector<future<vector<Document>>> limited_scheduled;
+        for (const string& query : limited_queries) {
+            limited_scheduled.push_back(limited_scheduler.FindTopDocumentsAsync(query));
+        }
+        for (size_t i = 0; i < limited_queries.size(); ++i) {
+            ASSERT(are_equal(limited_scheduled[i].get(), results[i]));
+        }
+    }
+    search_server.RemoveDocument(thread_pool.Limit(2), 1);
+    ASSERT(search_server.GetDocumentCount() == 3000 - 231 - 1);
+}
+
+namespace {
+// Exhaustive search: every live document is scored from its text and the best relevances are returned, best first
+template <typename ScoringModel, typename DocumentPredicate>
+vector<double> FindTopRelevancesExhaustively(const vector<map<string, int>>& document_words, const vector<int>& document_lengths,
+    const vector<bool>& is_removed, const vector<DocumentStatus>& statuses, const vector<int>& ratings,
+    const vector<string>& plus_words, const vector<string>& minus_words, DocumentPredicate document_predicate) {
+    int live_count = 0;
+    long long total_length = 0;
+    for (size_t id = 0; id < document_words.size(); ++id) {
+        if (!is_removed[id]) {
+            ++live_count;
+            total_length += document_lengths[id];
+        }
+    }
+    const double average_length = static_cast<double>(total_length) / live_count;
+    map<string, int> document_counts;
+    for (const string& word : plus_words) {
+        for (size_t id = 0; id < document_words.size(); ++id) {
+            document_counts[word] += !is_removed[id] && document_words[id].count(word) > 0;
+        }
+    }
+    vector<double> relevances;
+    for (size_t id = 0; id < document_words.size(); ++id) {
+        const auto& words = document_words[id];
+        const bool is_excluded = any_of(minus_words.begin(), minus_words.end(), [&words](const string& word) {
+            return words.count(word) > 0;
+            });
+        if (is_removed[id] || is_excluded || !document_predicate(static_cast<int>(id), statuses[id], ratings[id])) {
+            continue;
+        }
+        bool has_plus_word = false;
+        double relevance = 0.0;
+        for (const string& word : plus_words) {
+            const auto it = words.find(word);
+            if (it == words.end()) {
+                continue;
+            }
+            has_plus_word = true;
+            const double term_freq = static_cast<double>(it->second) / document_lengths[id];
+            relevance += ScoringModel::Score(term_freq, log(live_count * 1.0 / document_counts.at(word)), document_lengths[id], average_length);
+        }
+        if (has_plus_word) {
+            relevances.push_back(relevance);
+        }
+    }
+    sort(relevances.begin(), relevances.end(), greater<double>());
+    relevances.resize(min(relevances.size(), static_cast<size_t>(MAX_RESULT_DOCUMENT_COUNT)));
+    return relevances;
+}
+}
+
+void TestPruningMatchesExhaustiveSearch() {
+    mt19937 generator(35);
+    const auto random_word = [&generator] {
+        return "w"s + to_string(min(generator() % 300, generator() % 300));
+    };
+    SearchServer search_server("and"s);
+    search_server.SetSegmentOptions({ 900, 4, false });
+    const int document_count = 4000;
+    vector<map<string, int>> document_words(document_count);
+    vector<int> document_lengths(document_count);
+    vector<bool> is_removed(document_count, false);
+    vector<DocumentStatus> statuses(document_count);
+    vector<int> ratings(document_count);
+    for (int id = 0; id < document_count; ++id) {
+        string text;
+        for (int i = 3 + generator() % 28; i > 0; --i) {
+            const string word = random_word();
+            ++document_words[id][word];
+            ++document_lengths[id];
+            text += word + ' ';
+        }
+        statuses[id] = id % 7 == 0 ? DocumentStatus::IRRELEVANT : DocumentStatus::ACTUAL;
+        ratings[id] = static_cast<int>(generator() % 10);
+        search_server.AddDocument(id, text, statuses[id], { ratings[id] });
+    }
+    for (int id = 0; id < document_count; id += 9) {
+        search_server.RemoveDocument(id);
+        is_removed[id] = true;
+    }
+
+    // Rare and common minus words, so both the per-candidate lookups and the bitmaps get used
+    const auto check_queries = [&](auto scoring_model, auto document_predicate) {
+        using ScoringModel = decltype(scoring_model);
+        for (int i = 0; i < 150; ++i) {
+            vector<string> plus_words;
+            vector<string> minus_words;
+            string query;
+            for (int j = 1 + generator() % 4; j > 0; --j) {
+                plus_words.push_back(random_word());
+                query += plus_words.back() + ' ';
+            }
+            for (int j = generator() % 5; j > 0; --j) {
+                minus_words.push_back(j % 2 == 0 ? random_word() : "w"s + to_string(generator() % 300));
+                query += '-' + minus_words.back() + ' ';
+            }
+            sort(plus_words.begin(), plus_words.end());
+            plus_words.erase(unique(plus_words.begin(), plus_words.end()), plus_words.end());
+            const vector<double> expected = FindTopRelevancesExhaustively<ScoringModel>(document_words, document_lengths, is_removed,
+                statuses, ratings, plus_words, minus_words, document_predicate);
+            for (const vector<Document>& found : { search_server.FindTopDocuments<ScoringModel>(query, document_predicate),
+                search_server.FindTopDocuments<ScoringModel>(execution::par, query, document_predicate) }) {
+                ASSERT(found.size() == expected.size());
+                // Hits within 1e-6 of each other rank by rating, so they are compared as values
+                vector<double> relevances;
+                for (const Document& document : found) {
+                    relevances.push_back(document.relevance);
+                }
+                sort(relevances.begin(), relevances.end(), greater<double>());
+                for (size_t j = 0; j < expected.size(); ++j) {
+                    ASSERT(abs(relevances[j] - expected[j]) < 2e-6);
+                }
+            }
+        }
+    };
+    const auto is_rated = [](int /*document_id*/, DocumentStatus /*status*/, int rating) {
+        return rating >= 3;
+    };
+    check_queries(TfIdfScoring{}, StatusIs{ DocumentStatus::ACTUAL });
+    check_queries(TfIdfScoring{}, is_rated);
+    check_queries(Bm25Scoring<>{}, StatusIs{ DocumentStatus::ACTUAL });
+    check_queries(Bm25Scoring<>{}, is_rated);
+
+    // A zero capacity still checks the query but scores nothing
+    ASSERT(search_server.FindTopDocuments("w1 w2"s, DocumentStatus::ACTUAL, nullptr, 0) == 0);
+    try {
+        search_server.FindTopDocuments("w1 --w2"s, DocumentStatus::ACTUAL, nullptr, 0);
+        ASSERT(false);
+    }
+    catch (const invalid_argument&) {
+    }
+}
+
+void TestAttributePredicates() {
+    mt19937 generator(30);
+    const auto random_word = [&generator] {
+        return "w"s + to_string(min(generator() % 200, generator() % 200));
+    };
+    SearchServer search_server("and"s);
+    search_server.SetSegmentOptions({ 500, 4, false });
+    const DocumentStatus statuses[] = { DocumentStatus::ACTUAL, DocumentStatus::IRRELEVANT, DocumentStatus::BANNED, DocumentStatus::REMOVED };
+    for (int id = 0; id < 2000; ++id) {
+        string text;
+        for (int i = 2 + generator() % 15; i > 0; --i) {
+            text += random_word() + ' ';
+        }
+        search_server.AddDocument(id, text, statuses[generator() % 4], { static_cast<int>(generator() % 10) - 2 });
+    }
+    for (int id = 0; id < 2000; id += 11) {
+        search_server.RemoveDocument(id);
+    }
+
+    const auto are_identical = [](const vector<Document>& lhs, const vector<Document>& rhs) {
+        return equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), [](const Document& lhs_document, const Document& rhs_document) {
+            return lhs_document.id == rhs_document.id && lhs_document.rating == rhs_document.rating
+                && lhs_document.relevance == rhs_document.relevance;
+            });
+    };
+    // The recognised predicates take the bitmap path, the lambdas the per-candidate path
+    const auto check = [&](auto scoring_model, const string& query) {
+        using ScoringModel = decltype(scoring_model);
+        for (const DocumentStatus status : statuses) {
+            const auto has_status = [status](int /*document_id*/, DocumentStatus document_status, int /*rating*/) {
+                return document_status == status;
+            };
+            const vector<Document> expected = search_server.FindTopDocuments<ScoringModel>(query, has_status);
+            ASSERT(are_identical(search_server.FindTopDocuments<ScoringModel>(query, StatusIs{ status }), expected));
+            ASSERT(are_identical(search_server.FindTopDocuments<ScoringModel>(query, status), expected));
+            ASSERT(are_identical(search_server.FindTopDocuments<ScoringModel>(execution::par, query, StatusIs{ status }), expected));
+        }
+        for (int min_rating = -2; min_rating <= 8; min_rating += 5) {
+            const auto is_rated = [min_rating](int /*document_id*/, DocumentStatus /*status*/, int rating) {
+                return rating >= min_rating;
+            };
+            const vector<Document> expected = search_server.FindTopDocuments<ScoringModel>(query, is_rated);
+            ASSERT(are_identical(search_server.FindTopDocuments<ScoringModel>(query, RatingAtLeast{ min_rating }), expected));
+            ASSERT(are_identical(search_server.FindTopDocuments<ScoringModel>(execution::par, query, RatingAtLeast{ min_rating }), expected));
+        }
+    };
+    for (int i = 0; i < 100; ++i) {
+        string query;
+        for (int j = 1 + generator() % 4; j > 0; --j) {
+            query += random_word() + ' ';
+        }
+        if (i % 3 == 0) {
+            query += '-' + random_word();
+        }
+        check(TfIdfScoring{}, query);
+        check(Bm25Scoring<>{}, query);
+    }
+}
+
+void TestFindNearDuplicates() {
+    const auto compute_similarity = [](const SearchServer& search_server, int lhs_id, int rhs_id) {
+        set<string_view> lhs_words, rhs_words;
+        for (const auto& [word, _] : search_server.GetWordFrequencies(lhs_id)) {
+            lhs_words.insert(word);
+        }
+        for (const auto& [word, _] : search_server.GetWordFrequencies(rhs_id)) {
+            rhs_words.insert(word);
+        }
+        const size_t common = count_if(lhs_words.begin(), lhs_words.end(), [&rhs_words](string_view word) {
+            return rhs_words.count(word) > 0;
+            });
+        return static_cast<double>(common) / (lhs_words.size() + rhs_words.size() - common);
+    };
+
+    {
+        SearchServer search_server("and"s);
+        // 1 ~ 2 and 2 ~ 3 at 9/11, but 1 and 3 only at 8/12: the chain must not pull 3 into the cluster of 1
+        search_server.AddDocument(1, "a1 a2 a3 a4 a5 a6 a7 a8 a9 a10"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.AddDocument(2, "a1 a2 a3 a4 a5 a6 a7 a8 a9 b1 and"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.AddDocument(3, "a1 a2 a3 a4 a5 a6 a7 a8 b1 c1"s, DocumentStatus::ACTUAL, { 1 });
+        // Equal word sets, whatever the order and the repeats
+        search_server.AddDocument(4, "d1 d2 d3 d4 d5 d6 d7 d8 d9 d10"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.AddDocument(5, "d10 d9 d8 d7 d6 d5 d4 d3 d2 d1 d1"s, DocumentStatus::BANNED, { 1 });
+        // 5/15 to both of them
+        search_server.AddDocument(6, "d1 d2 d3 d4 d5 f1 f2 f3 f4 f5"s, DocumentStatus::ACTUAL, { 1 });
+        search_server.AddDocument(7, "g1 g2 g3 g4 g5 g6"s, DocumentStatus::ACTUAL, { 1 });
+        ASSERT(compute_similarity(search_server, 1, 2) == 9.0 / 11);
+        ASSERT(compute_similarity(search_server, 2, 3) == 9.0 / 11);
+        ASSERT(compute_similarity(search_server, 1, 3) == 8.0 / 12);
+
+        const vector<vector<int>> expected = { { 1, 2 }, { 4, 5 } };
+        ASSERT(FindNearDuplicates(search_server) == expected);
+        NearDuplicateOptions options;
+        options.max_leaders = 1;
+        ASSERT(FindNearDuplicates(search_server, options) == expected);
+        // Below 8/12 the whole chain is similar to its leader
+        options.similarity_threshold = 0.6;
+        ASSERT(FindNearDuplicates(search_server, options) == vector<vector<int>>({ { 1, 2, 3 }, { 4, 5 } }));
+        options.similarity_threshold = 1.0;
+        ASSERT(FindNearDuplicates(search_server, options) == vector<vector<int>>({ { 4, 5 } }));
+    }
+
+    // Mutated copies of random documents: every member is verified against its cluster's leader,
+    // and no document is in two clusters
+    mt19937 generator(34);
+    SearchServer search_server(""s);
+    vector<vector<string>> texts;
+    for (int id = 0; id < 600; ++id) {
+        vector<string> words;
+        if (id % 3 != 0 || texts.empty()) {
+            for (int i = 0; i < 20; ++i) {
+                words.push_back("w"s + to_string(generator() % 1000));
+            }
+        }
+        else {
+            words = texts[generator() % texts.size()];
+            for (int i = generator() % 4; i > 0; --i) {
+                words[generator() % words.size()] = "w"s + to_string(generator() % 1000);
+            }
+        }
+        string text;
+        for (const string& word : words) {
+            text += word + ' ';
+        }
+        search_server.AddDocument(id, text, DocumentStatus::ACTUAL, { 1 });
+        texts.push_back(move(words));
+    }
+    const NearDuplicateOptions options;
+    const vector<vector<int>> clusters = FindNearDuplicates(search_server, options);
+    ASSERT(!clusters.empty());
+    set<int> clustered_ids;
+    for (const vector<int>& cluster : clusters) {
+        ASSERT(cluster.size() > 1);
+        ASSERT(is_sorted(cluster.begin(), cluster.end()));
+        for (const int document_id : cluster) {
+            ASSERT(clustered_ids.insert(document_id).second);
+            ASSERT(document_id == cluster.front() || compute_similarity(search_server, cluster.front(), document_id) >= options.similarity_threshold);
+        }
+    }
+}
+
+void TestIngestCorpus() {
+    const string corpus_path = MakeTemporaryPath("corpus.txt"s);
+    const auto write_corpus = [&corpus_path](const string& contents) {
+        ofstream(corpus_path, ios::binary) << contents;
+    };
+
+    {
+        // Empty lines take no id, a line with a control character takes one and is skipped
+        const string contents = "funny pet\n\nnasty rat\r\ncurly \x01 hair\nbig dog"s;
+        write_corpus(contents);
+        SearchServer search_server("and"s);
+        IngestOptions options;
+        options.first_document_id = 10;
+        options.batch_size = 1;
+        options.max_queued_batches = 1;
+        const IngestStats stats = IngestCorpus(corpus_path, search_server, options);
+        ASSERT(stats.indexed_documents == 3 && stats.skipped_documents == 1 && stats.bytes == contents.size());
+        ASSERT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({ 10, 11, 13 }));
+        const vector<Document> found = search_server.FindTopDocuments("rat"s);
+        ASSERT(found.size() == 1 && found[0].id == 11 && found[0].rating == 0);
+        const auto [words, status] = search_server.MatchDocument("nasty rat dog"s, 11);
+        ASSERT(words == vector<string_view>({ "nasty"sv, "rat"sv }) && status == DocumentStatus::ACTUAL);
+    }
+    {
+        write_corpus("1\tACTUAL\t5 7\tfunny pet and rat\n"s
+            "2\t2\t\tnasty rat\n"s
+            "x\tACTUAL\t1\tinvalid id\n"s
+            "3\tUNKNOWN\t1\tinvalid status\n"s
+            "4\tACTUAL\t1 y\tinvalid rating\n"s
+            "1\tACTUAL\t1\tduplicate id\n"s
+            "5\tIRRELEVANT\t-3\tcurly \x02 hair\n"s
+            "6\t1\t-3\tcurly hair\n"s);
+        SearchServer search_server("and"s);
+        IngestOptions options;
+        options.format = CorpusFormat::FRAMED;
+        const IngestStats stats = IngestCorpus(corpus_path, search_server, options);
+        ASSERT(stats.indexed_documents == 3 && stats.skipped_documents == 5);
+        ASSERT(vector<int>(search_server.begin(), search_server.end()) == vector<int>({ 1, 2, 6 }));
+        const vector<Document> actual = search_server.FindTopDocuments("rat"s);
+        ASSERT(actual.size() == 1 && actual[0].id == 1 && actual[0].rating == 6);
+        const vector<Document> banned = search_server.FindTopDocuments("rat"s, DocumentStatus::BANNED);
+        ASSERT(banned.size() == 1 && banned[0].id == 2 && banned[0].rating == 0);
+        const vector<Document> irrelevant = search_server.FindTopDocuments("hair"s, DocumentStatus::IRRELEVANT);
+        ASSERT(irrelevant.size() == 1 && irrelevant[0].id == 6 && irrelevant[0].rating == -3);
+        ASSERT(search_server.GetWordFrequencies(1).size() == 3);
+    }
+    filesystem::remove(corpus_path);
+}
+
+void TestSearchHitBuffers() {
+    SearchServer search_server("and with"s);
+    AddTestDocuments(search_server, 0, 16);
+    const auto is_prefix = [](const SearchHit* hits, size_t hit_count, const vector<Document>& documents) {
+        return hit_count <= documents.size() && equal(hits, hits + hit_count, documents.begin(), [](const SearchHit& hit, const Document& document) {
+            return hit.id == document.id && hit.relevance == document.relevance && hit.rating == document.rating;
+            });
+    };
+
+    vector<SearchHit> reused(10, SearchHit{ -1, -1.0, -1 });
+    for (const string& query : TEST_QUERIES) {
+        const vector<Document> expected = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL);
+        // Fewer slots than results keep the best ones; more slots than results leave the rest untouched
+        for (size_t hit_capacity = 0; hit_capacity <= MAX_RESULT_DOCUMENT_COUNT + 2; ++hit_capacity) {
+            array<SearchHit, MAX_RESULT_DOCUMENT_COUNT + 3> hits;
+            hits.fill(SearchHit{ -1, -1.0, -1 });
+            const size_t hit_count = search_server.FindTopDocuments(query, DocumentStatus::ACTUAL, hits.data(), hit_capacity);
+            ASSERT(hit_count == min(hit_capacity, expected.size()));
+            ASSERT(is_prefix(hits.data(), hit_count, expected));
+            ASSERT(all_of(hits.begin() + hit_count, hits.end(), [](const SearchHit& hit) { return hit.id == -1; }));
+        }
+        // The vector is overwritten, whatever it held before
+        search_server.FindTopDocuments(query, StatusIs{ DocumentStatus::ACTUAL }, reused);
+        ASSERT(reused.size() == expected.size() && is_prefix(reused.data(), reused.size(), expected));
+    }
+    ASSERT(search_server.FindTopDocuments("rat"s, DocumentStatus::ACTUAL, nullptr, 0) == 0);
+    try {
+        search_server.FindTopDocuments("rat --dog"s, DocumentStatus::ACTUAL, reused);
+        ASSERT(false);
+    }
+    catch (const invalid_argument&) {
+    }
+}
+
+void TestRequestQueue() {
+    SearchServer search_server("and with"s);
+    AddTestDocuments(search_server, 0, 8);
+    RequestQueue request_queue(search_server);
+    vector<SearchHit> hits;
+
+    // A day holds 1440 requests; the oldest ones drop out of the no-result count
+    for (int i = 0; i < 1439; ++i) {
+        request_queue.AddFindRequest("zebra"s);
+    }
+    ASSERT(request_queue.GetNoResultRequests() == 1439);
+    request_queue.AddFindRequest("curly dog"s, DocumentStatus::ACTUAL, hits);
+    ASSERT(hits.size() == 5 && request_queue.GetNoResultRequests() == 1439);
+    ASSERT(request_queue.AddFindRequest("big dog"s).size() == 2);
+    ASSERT(request_queue.GetNoResultRequests() == 1438);
+    request_queue.AddFindRequest("zebra"s, DocumentStatus::ACTUAL, hits);
+    ASSERT(hits.empty() && request_queue.GetNoResultRequests() == 1438);
+    ASSERT(request_queue.AddFindRequest("rat"s, DocumentStatus::BANNED).empty());
+    ASSERT(request_queue.GetNoResultRequests() == 1438);
+    const auto has_even_id = [](int document_id, DocumentStatus /*status*/, int /*rating*/) {
+        return document_id % 2 == 0;
+    };
+    for (int i = 0; i < 1440; ++i) {
+        request_queue.AddFindRequest("pet"s, has_even_id);
+    }
+    ASSERT(request_queue.GetNoResultRequests() == 0);
+}
+
+void TestConcurrentUpdates() {
+    const auto make_text = [](int id) {
+        return TEST_DOCUMENTS[id % TEST_DOCUMENTS.size()] + " w"s + to_string(id % 37);
+    };
+    const auto is_removed = [](int id) {
+        return id >= 200 && id < 2200 && id % 2 == 0;
+    };
+    SearchServer search_server("and with"s);
+    search_server.SetSegmentOptions({ 64, 4, true });
+    for (int id = 0; id < 500; ++id) {
+        search_server.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, { id % 5 });
+    }
+
+    // One thread changes the index while the others query it every way there is
+    atomic<bool> writing = true;
+    thread writer([&] {
+        for (int id = 500; id < 2500; ++id) {
+            search_server.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, { id % 5 });
+            if (is_removed(id - 300)) {
+                search_server.RemoveDocument(execution::par, id - 300);
+            }
+            if (id % 700 == 0) {
+                search_server.MergeAllSegments();
+            }
+        }
+        writing = false;
+        });
+    const vector<string> queries(TEST_QUERIES.begin(), TEST_QUERIES.end());
+    const auto read = [&] {
+        while (writing) {
+            for (const string& query : queries) {
+                for (const Document& document : search_server.FindTopDocuments(query)) {
+                    ASSERT(document.id >= 0 && document.id < 2500 && !is_removed(document.id));
+                }
+                ASSERT(search_server.FindTopDocuments(execution::par, query).size() <= MAX_RESULT_DOCUMENT_COUNT);
+            }
+            ASSERT(search_server.FindTopDocumentsBatch(queries).size() == queries.size());
+            const auto [words, status] = search_server.MatchDocument("funny pet"s, 1);
+            ASSERT(words.size() == 2 && status == DocumentStatus::ACTUAL);
+            ASSERT(search_server.GetPostingLength("funny"s) > 0);
+            ASSERT(search_server.GetIndexStats().document_count >= 500);
+            ASSERT(search_server.GetDocumentCount() >= 500);
+        }
+    };
+    thread reader(read);
+    read();
+    writer.join();
+    reader.join();
+
+    SearchServer expected("and with"s);
+    for (int id = 0; id < 2500; ++id) {
+        if (!is_removed(id)) {
+            expected.AddDocument(id, make_text(id), DocumentStatus::ACTUAL, { id % 5 });
+        }
+    }
+    ASSERT(HaveSameResults(search_server, expected));
+}
+
+#ifdef __linux__
+void TestQueryServerRequests() {
+    SearchServer search_server("and with"s);
+    AddTestDocuments(search_server, 0, 8);
+    const auto handle = [&search_server](string_view request) {
+        return QueryServer::HandleRequest(search_server, request);
+    };
+
+    ASSERT(handle("PING"sv) == "OK"s);
+    ASSERT(handle("PING\r"sv) == "OK"s);
+
+    // FIND answers with the count, then id, relevance and rating of every hit
+    for (const string& query : TEST_QUERIES) {
+        const vector<Document> expected = search_server.FindTopDocuments(query);
+        istringstream response(handle("FIND "s + query));
+        string status;
+        size_t count = 0;
+        response >> status >> count;
+        ASSERT(status == "OK"s && count == expected.size());
+        for (const Document& document : expected) {
+            int id = 0;
+            double relevance = 0.0;
+            int rating = 0;
+            response >> id >> relevance >> rating;
+            ASSERT(id == document.id && rating == document.rating && abs(relevance - document.relevance) <= 1e-5 * document.relevance);
+        }
+        ASSERT(response && response.peek() == char_traits<char>::eof());
+    }
+    ASSERT(handle("FIND zebra"sv) == "OK 0"s);
+
+    // MATCH lists the matched plus words, none if a minus word matches
+    ASSERT(handle("MATCH 1 curly funny cat"sv) == "OK ACTUAL curly funny"s);
+    ASSERT(handle("MATCH 1 curly -funny"sv) == "OK ACTUAL"s);
+
+    // Malformed requests get an error and don't throw
+    ASSERT(handle(""sv) == "ERR unknown command"s);
+    ASSERT(handle("HELLO world"sv) == "ERR unknown command"s);
+    ASSERT(handle("find rat"sv) == "ERR unknown command"s);
+    ASSERT(handle("MATCH x rat"sv) == "ERR invalid document id"s);
+    ASSERT(handle("MATCH 12x rat"sv) == "ERR invalid document id"s);
+    ASSERT(handle("MATCH 42 rat"sv).rfind("ERR "s, 0) == 0);
+    ASSERT(handle("FIND rat --dog"sv).rfind("ERR "s, 0) == 0);
+    ASSERT(handle("FIND rat -"sv).rfind("ERR "s, 0) == 0);
+
+    // Pipelined requests through a socket come back in order, also when the concurrency limit makes them wait
+    const string socket_path = MakeTemporaryPath("query_server.sock"s);
+    QueryServer server(search_server, ThreadPool::GetDefault().Limit(1));
+    server.ListenUnix(socket_path);
+    thread serving([&server] { server.Run(); });
+    const int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    socket_path.copy(address.sun_path, sizeof(address.sun_path) - 1);
+    ASSERT(connect(client, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == 0);
+    string requests;
+    string expected;
+    for (size_t i = 0; i < 100; ++i) {
+        const string request = i % 10 == 9 ? "MATCH 1 curly funny"s : i % 10 == 8 ? "FIND rat --dog"s : "FIND "s + TEST_QUERIES[i % TEST_QUERIES.size()];
+        requests += request + '\n';
+        expected += handle(request) + '\n';
+    }
+    ASSERT(write(client, requests.data(), requests.size()) == static_cast<ssize_t>(requests.size()));
+    string responses;
+    char buffer[4096];
+    while (responses.size() < expected.size()) {
+        const ssize_t count = read(client, buffer, sizeof(buffer));
+        ASSERT(count > 0);
+        responses.append(buffer, static_cast<size_t>(count));
+    }
+    ASSERT(responses == expected);
+    close(client);
+    server.Stop();
+    serving.join();
+    filesystem::remove(socket_path);
+}
+#endif
+
+void TestSearchServer() {
+    TestWriteAheadLogReplay();
+    TestSnapshotRecovery();
+    TestSegmentMerges();
+    TestIndexStats();
+    TestBatchMatchesSingleQueries();
+    TestPruningMatchesExhaustiveSearch();
+    TestAttributePredicates();
+    TestFindNearDuplicates();
+    TestIngestCorpus();
+    TestSearchHitBuffers();
+    TestRequestQueue();
+    TestConcurrentUpdates();
+#ifdef __linux__
+    TestQueryServerRequests();
+#endif
+}
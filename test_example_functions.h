@@ -1 +1,33 @@
 #pragma once
+
+// Journal replay, including a record torn by a crash
+void TestWriteAheadLogReplay();
+// Snapshot plus log tail, and a crash between writing the snapshot and truncating the log
+void TestSnapshotRecovery();
+// Results don't depend on how the documents are split into segments or merged
+void TestSegmentMerges();
+// Index statistics count live documents and postings through adds, removals and merges
+void TestIndexStats();
+// FindTopDocumentsBatch returns what FindTopDocuments returns for each query
+void TestBatchMatchesSingleQueries();
+// The pruned searches and their minus word exclusion return what scoring every document returns
+void TestPruningMatchesExhaustiveSearch();
+// StatusIs and RatingAtLeast return exactly what the equivalent lambdas return
+void TestAttributePredicates();
+// Near duplicate clusters are stars around a verified leader, not chains
+void TestFindNearDuplicates();
+// Both corpus formats, with empty, malformed and rejected lines
+void TestIngestCorpus();
+// The SearchHit overloads return a prefix of FindTopDocuments, cut at the capacity
+void TestSearchHitBuffers();
+// The no-result count of RequestQueue covers the last 1440 requests
+void TestRequestQueue();
+// Queries of every kind run while another thread adds and removes documents
+void TestConcurrentUpdates();
+#ifdef __linux__
+// QueryServer's responses to FIND, MATCH, PING and malformed requests
+void TestQueryServerRequests();
+#endif
+
+// Runs all the tests above; aborts with a message on the first failure
+void TestSearchServer();
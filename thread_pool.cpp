@@ -0,0 +1,230 @@
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#elif defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std;
+
+namespace {
+// Pool and deque owned by the calling thread, if it is a worker
+thread_local const ThreadPool* current_pool = nullptr;
+thread_local size_t current_queue = 0;
+
+// A waiting thread re-checks for stealable work this often
+const auto WAIT_SLICE = chrono::milliseconds(1);
+
+// Pins the calling thread to the cpu-th of the CPUs it is allowed to run on (modulo their number),
+// so pinning respects taskset, cgroup cpusets and process affinity masks
+void PinCurrentThread(size_t cpu) {
+#ifdef _WIN32
+    DWORD_PTR process_mask = 0;
+    DWORD_PTR system_mask = 0;
+    if (!GetProcessAffinityMask(GetCurrentProcess(), &process_mask, &system_mask) || process_mask == 0) {
+        return;
+    }
+    size_t allowed_count = 0;
+    for (DWORD_PTR mask = process_mask; mask != 0; mask &= mask - 1) {
+        ++allowed_count;
+    }
+    cpu %= allowed_count;
+    for (size_t bit = 0; bit < sizeof(DWORD_PTR) * 8; ++bit) {
+        if ((process_mask & (DWORD_PTR(1) << bit)) != 0 && cpu-- == 0) {
+            SetThreadAffinityMask(GetCurrentThread(), DWORD_PTR(1) << bit);
+            return;
+        }
+    }
+#elif defined(__linux__)
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0) {
+        return;
+    }
+    cpu %= static_cast<size_t>(CPU_COUNT(&allowed));
+    for (size_t id = 0; id < CPU_SETSIZE; ++id) {
+        if (CPU_ISSET(id, &allowed) && cpu-- == 0) {
+            cpu_set_t cpus;
+            CPU_ZERO(&cpus);
+            CPU_SET(id, &cpus);
+            pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+            return;
+        }
+    }
+#else
+    (void)cpu;
+#endif
+}
+}
+
+ThreadPool::ThreadPool(const ThreadPoolOptions& options) {
+    const size_t thread_count = options.thread_count > 0 ? options.thread_count : max(thread::hardware_concurrency(), 1u);
+    queues_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        queues_.push_back(make_unique<WorkQueue>());
+    }
+    workers_.reserve(thread_count);
+    for (size_t i = 0; i < thread_count; ++i) {
+        workers_.emplace_back([this, i, options] { RunWorker(i, options); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        lock_guard guard(sleep_mutex_);
+        stopping_ = true;
+    }
+    has_tasks_.notify_all();
+    for (thread& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size();
+}
+
+void ThreadPool::Post(function<void()> task) {
+    // Workers keep what they spawn
+    WorkQueue& queue = current_pool == this ? *queues_[current_queue] : injected_;
+    ++queued_task_count_;
+    {
+        lock_guard guard(queue.mutex);
+        queue.tasks.push_back(move(task));
+    }
+    {
+        // Pairs with the predicate check in RunWorker, so the wake-up can't be missed
+        lock_guard guard(sleep_mutex_);
+    }
+    has_tasks_.notify_one();
+}
+
+ThreadPool& ThreadPool::GetDefault() {
+    static ThreadPool thread_pool;
+    return thread_pool;
+}
+
+bool ThreadPool::RunQueuedTask() {
+    const bool is_worker = current_pool == this;
+    const auto take = [](WorkQueue& queue, bool from_back, function<void()>& task) {
+        lock_guard guard(queue.mutex);
+        if (queue.tasks.empty()) {
+            return false;
+        }
+        if (from_back) {
+            task = move(queue.tasks.back());
+            queue.tasks.pop_back();
+        }
+        else {
+            task = move(queue.tasks.front());
+            queue.tasks.pop_front();
+        }
+        return true;
+    };
+
+    // Own deque LIFO for locality, then outside submissions in order, then steal FIFO
+    // so the oldest (usually largest) piece of someone else's work moves
+    const size_t home = is_worker ? current_queue : 0;
+    function<void()> task;
+    bool found = is_worker && take(*queues_[home], true, task);
+    found = found || take(injected_, false, task);
+    for (size_t i = is_worker ? 1 : 0; i < queues_.size() && !found; ++i) {
+        found = take(*queues_[(home + i) % queues_.size()], false, task);
+    }
+    if (!found) {
+        return false;
+    }
+    --queued_task_count_;
+    try {
+        task();
+    }
+    catch (...) {
+    }
+    return true;
+}
+
+void ThreadPool::RunWorker(size_t index, const ThreadPoolOptions& options) {
+    current_pool = this;
+    current_queue = index;
+    if (options.pin_to_cpus) {
+        PinCurrentThread(options.first_cpu + index);
+    }
+    while (true) {
+        if (RunQueuedTask()) {
+            continue;
+        }
+        unique_lock lock(sleep_mutex_);
+        has_tasks_.wait(lock, [this] { return stopping_ || queued_task_count_ > 0; });
+        if (stopping_ && queued_task_count_ == 0) {
+            return;
+        }
+    }
+}
+
+TaskGroup::TaskGroup(ThreadPool& thread_pool)
+    : thread_pool_(thread_pool)
+{
+}
+
+TaskGroup::~TaskGroup() {
+    WaitForTasks();
+}
+
+void TaskGroup::Run(function<void()> task) {
+    {
+        lock_guard guard(mutex_);
+        ++running_count_;
+    }
+    thread_pool_.Post([this, task = move(task)] {
+        exception_ptr error;
+        try {
+            task();
+        }
+        catch (...) {
+            error = current_exception();
+        }
+        // Notify under the lock: once running_count_ drops to 0 the group may be destroyed
+        lock_guard guard(mutex_);
+        if (error && !error_) {
+            error_ = error;
+        }
+        if (--running_count_ == 0) {
+            all_done_.notify_all();
+        }
+        });
+}
+
+void TaskGroup::Wait() {
+    WaitForTasks();
+    exception_ptr error;
+    {
+        lock_guard guard(mutex_);
+        swap(error, error_);
+    }
+    if (error) {
+        rethrow_exception(error);
+    }
+}
+
+void TaskGroup::WaitForTasks() {
+    while (true) {
+        {
+            lock_guard guard(mutex_);
+            if (running_count_ == 0) {
+                return;
+            }
+        }
+        if (thread_pool_.RunQueuedTask()) {
+            continue;
+        }
+        unique_lock lock(mutex_);
+        all_done_.wait_for(lock, WAIT_SLICE, [this] { return running_count_ == 0; });
+    }
+}
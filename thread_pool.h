@@ -0,0 +1,201 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <execution>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+class LimitedThreadPool;
+
+struct ThreadPoolOptions {
+    // 0 starts one worker per hardware thread
+    size_t thread_count = 0;
+    // Pins worker i to the (first_cpu + i)-th of the CPUs the process may run on, modulo their number
+    bool pin_to_cpus = false;
+    size_t first_cpu = 0;
+};
+
+// Work-stealing thread pool. Every worker owns a deque: tasks it spawns go to the back
+// and are taken back LIFO, while idle workers steal from the front of the others.
+// Tasks posted from outside the pool wait in a shared FIFO queue, so they run in order.
+// A thread waiting in TaskGroup::Wait or ParallelFor runs queued tasks meanwhile, so
+// nested parallelism (a parallel query inside a parallel batch) reuses the pool's
+// threads instead of oversubscribing the cores.
+class ThreadPool {
+public:
+    explicit ThreadPool(const ThreadPoolOptions& options = {});
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    // Runs every task already queued, then stops the workers
+    ~ThreadPool();
+
+    size_t GetThreadCount() const;
+
+    // Queues a task; anything it throws is dropped, use TaskGroup to get exceptions back
+    void Post(std::function<void()> task);
+
+    // Calls function(i) for every i in [0, count) and returns once all calls are done.
+    // At most max_concurrency threads, the calling one included, work on it at a time;
+    // 0 means as many as the pool has plus the caller. Indexes are handed out one by one,
+    // so uneven calls balance themselves. The first exception thrown is rethrown here
+    // and the indexes not started yet are skipped
+    template <typename Function>
+    void ParallelFor(size_t count, Function function, size_t max_concurrency = 0);
+
+    // The pool with at most max_concurrency threads per call, to pass where a pool or
+    // an execution policy is taken: search_server.FindTopDocuments(pool.Limit(2), query)
+    LimitedThreadPool Limit(size_t max_concurrency);
+
+    // Pool used by everything that isn't given one explicitly
+    static ThreadPool& GetDefault();
+
+private:
+    friend class TaskGroup;
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::unique_ptr<WorkQueue>> queues_;
+    WorkQueue injected_;
+    std::vector<std::thread> workers_;
+    std::mutex sleep_mutex_;
+    std::condition_variable has_tasks_;
+    std::atomic<size_t> queued_task_count_ = 0;
+    bool stopping_ = false;
+
+    // Runs one queued task on the calling thread; false if there was none
+    bool RunQueuedTask();
+    void RunWorker(size_t index, const ThreadPoolOptions& options);
+};
+
+// Fork/join over a ThreadPool: Run() forks tasks, Wait() joins them
+class TaskGroup {
+public:
+    explicit TaskGroup(ThreadPool& thread_pool);
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+    // Waits for the tasks still running; their exceptions are dropped
+    ~TaskGroup();
+
+    void Run(std::function<void()> task);
+    // Helps the pool while waiting; rethrows the first exception one of the tasks threw
+    void Wait();
+
+private:
+    ThreadPool& thread_pool_;
+    std::mutex mutex_;
+    std::condition_variable all_done_;
+    size_t running_count_ = 0;
+    std::exception_ptr error_;
+
+    void WaitForTasks();
+};
+
+// A pool plus the concurrency limit of the calls made through it; 0 means no limit
+class LimitedThreadPool {
+public:
+    LimitedThreadPool(ThreadPool& thread_pool, size_t max_concurrency = 0)
+        : thread_pool_(thread_pool), max_concurrency_(max_concurrency) {
+    }
+
+    template <typename Function>
+    void ParallelFor(size_t count, Function function) const {
+        thread_pool_.ParallelFor(count, function, max_concurrency_);
+    }
+
+    ThreadPool& GetThreadPool() const {
+        return thread_pool_;
+    }
+    size_t GetMaxConcurrency() const {
+        return max_concurrency_;
+    }
+
+private:
+    ThreadPool& thread_pool_;
+    size_t max_concurrency_;
+};
+
+inline LimitedThreadPool ThreadPool::Limit(size_t max_concurrency) {
+    return { *this, max_concurrency };
+}
+
+template <typename Function>
+void ThreadPool::ParallelFor(size_t count, Function function, size_t max_concurrency) {
+    size_t concurrency = std::min(count, GetThreadCount() + 1);
+    if (max_concurrency > 0) {
+        concurrency = std::min(concurrency, max_concurrency);
+    }
+    if (concurrency <= 1) {
+        for (size_t i = 0; i < count; ++i) {
+            function(i);
+        }
+        return;
+    }
+
+    std::atomic<size_t> next_index = 0;
+    std::atomic<bool> failed = false;
+    const auto work = [&] {
+        try {
+            for (size_t i = next_index++; i < count && !failed; i = next_index++) {
+                function(i);
+            }
+        }
+        catch (...) {
+            failed = true;
+            throw;
+        }
+    };
+
+    TaskGroup group(*this);
+    for (size_t i = 1; i < concurrency; ++i) {
+        group.Run(work);
+    }
+    std::exception_ptr error;
+    try {
+        work();
+    }
+    catch (...) {
+        error = std::current_exception();
+    }
+    try {
+        group.Wait();
+    }
+    catch (...) {
+        if (!error) {
+            error = std::current_exception();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+// Calls function(i) for every i in [0, count) as policy asks: a ThreadPool or LimitedThreadPool
+// runs the calls on its pool, the standard parallel policies on ThreadPool::GetDefault() and
+// std::execution::seq on the calling thread
+template <typename ExecutionPolicy, typename Function>
+void ForEachIndex(ExecutionPolicy&& policy, size_t count, Function function) {
+    using Policy = std::decay_t<ExecutionPolicy>;
+    if constexpr (std::is_same_v<Policy, ThreadPool> || std::is_same_v<Policy, LimitedThreadPool>) {
+        policy.ParallelFor(count, function);
+    }
+    else if constexpr (std::is_same_v<Policy, std::execution::sequenced_policy>) {
+        for (size_t i = 0; i < count; ++i) {
+            function(i);
+        }
+    }
+    else {
+        ThreadPool::GetDefault().ParallelFor(count, function);
+    }
+}
@@ -0,0 +1,161 @@
+#include "write_ahead_log.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include "search_server.h"
+
+using namespace std;
+
+// Record layout, one per operation:
+//   A <sequence> <id> <status> <ratings count> <ratings...> <text size>\n<text>\n
+//   R <sequence> <id>\n
+
+namespace {
+struct LogRecord {
+    uint64_t sequence = 0;
+    char operation = 0;
+    int document_id = 0;
+    DocumentStatus status = DocumentStatus::ACTUAL;
+    vector<int> ratings;
+    string text;
+};
+
+// Reads the next complete record; false at the end of the log or at a torn record
+bool ReadLogRecord(istream& in, LogRecord& record) {
+    string header;
+    if (!getline(in, header) || in.eof()) {
+        // A header line without its '\n' was not completed
+        return false;
+    }
+    istringstream fields(header);
+    fields >> record.operation >> record.sequence >> record.document_id;
+    if (!fields) {
+        return false;
+    }
+    if (record.operation == 'R') {
+        return true;
+    }
+    if (record.operation != 'A') {
+        return false;
+    }
+
+    int status = 0;
+    size_t ratings_count = 0;
+    fields >> status >> ratings_count;
+    record.ratings.resize(ratings_count);
+    for (int& rating : record.ratings) {
+        fields >> rating;
+    }
+    size_t text_size = 0;
+    fields >> text_size;
+    if (!fields) {
+        return false;
+    }
+    record.status = static_cast<DocumentStatus>(status);
+    record.text.resize(text_size);
+    in.read(record.text.data(), text_size);
+    return in.gcount() == static_cast<streamsize>(text_size) && in.get() == '\n';
+}
+}
+
+WriteAheadLog::WriteAheadLog(const string& path, bool sync_each_record)
+    : file_(path, false)
+    , sync_each_record_(sync_each_record)
+{
+    ifstream in(path, ios::binary);
+    LogRecord record;
+    uint64_t complete_size = 0;
+    while (ReadLogRecord(in, record)) {
+        next_sequence_ = record.sequence + 1;
+        complete_size = static_cast<uint64_t>(in.tellg());
+    }
+    in.clear();
+    in.seekg(0, ios::end);
+    if (static_cast<uint64_t>(in.tellg()) > complete_size) {
+        // Records appended after a torn one would never be replayed
+        file_.Truncate(complete_size);
+    }
+}
+
+uint64_t WriteAheadLog::LogAddDocument(int document_id, string_view document, DocumentStatus status, const vector<int>& ratings) {
+    record_.clear();
+    record_ += "A "s;
+    record_ += to_string(next_sequence_);
+    record_ += ' ';
+    record_ += to_string(document_id);
+    record_ += ' ';
+    record_ += to_string(static_cast<int>(status));
+    record_ += ' ';
+    record_ += to_string(ratings.size());
+    for (const int rating : ratings) {
+        record_ += ' ';
+        record_ += to_string(rating);
+    }
+    record_ += ' ';
+    record_ += to_string(document.size());
+    record_ += '\n';
+    record_ += document;
+    record_ += '\n';
+    return Commit();
+}
+
+uint64_t WriteAheadLog::LogRemoveDocument(int document_id) {
+    record_.clear();
+    record_ += "R "s;
+    record_ += to_string(next_sequence_);
+    record_ += ' ';
+    record_ += to_string(document_id);
+    record_ += '\n';
+    return Commit();
+}
+
+void WriteAheadLog::Sync() {
+    file_.Sync();
+}
+
+void WriteAheadLog::Truncate() {
+    file_.Truncate();
+}
+
+void WriteAheadLog::SkipSequencesBelow(uint64_t sequence) {
+    next_sequence_ = max(next_sequence_, sequence);
+}
+
+uint64_t WriteAheadLog::Commit() {
+    // One write per record, so a crash leaves at most the last record torn
+    file_.Append(record_);
+    if (sync_each_record_) {
+        file_.Sync();
+    }
+    return next_sequence_++;
+}
+
+int ReplayWriteAheadLog(const string& path, SearchServer& search_server) {
+    ifstream in(path, ios::binary);
+    int applied = 0;
+    LogRecord record;
+    while (ReadLogRecord(in, record)) {
+        if (record.sequence <= search_server.log_sequence_) {
+            // Already covered by the snapshot the server was loaded from
+            continue;
+        }
+        if (record.operation == 'A') {
+            search_server.AddDocument(record.document_id, record.text, record.status, record.ratings);
+        }
+        else {
+            search_server.RemoveDocument(record.document_id);
+        }
+        search_server.log_sequence_ = record.sequence;
+        ++applied;
+    }
+    return applied;
+}
+
+int RecoverIndex(const string& snapshot_path, const string& log_path, SearchServer& search_server) {
+    if (ifstream(snapshot_path, ios::binary)) {
+        search_server.LoadSnapshot(snapshot_path);
+    }
+    return ReplayWriteAheadLog(log_path, search_server);
+}
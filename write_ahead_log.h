@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "document.h"
+#include "durable_storage.h"
+
+class SearchServer;
+
+// Append-only journal of AddDocument/RemoveDocument calls. Records are numbered and each one
+// is synced to disk before the index changes, so after a crash the last snapshot plus the
+// records logged after it rebuild the same index without the original corpus (see RecoverIndex).
+class WriteAheadLog {
+public:
+    // A torn record left at the end by a crash is cut off, so new records follow the last complete one.
+    // sync_each_record = false leaves syncing to Sync(), e.g. once per ingested batch
+    explicit WriteAheadLog(const std::string& path, bool sync_each_record = true);
+
+    // Both return the record's sequence number
+    uint64_t LogAddDocument(int document_id, std::string_view document, DocumentStatus status, const std::vector<int>& ratings);
+    uint64_t LogRemoveDocument(int document_id);
+    void Sync();
+
+    // Drops all records, e.g. once a snapshot covers them. Numbering goes on where it was
+    void Truncate();
+
+    // Records logged from now on are numbered from at least sequence
+    void SkipSequencesBelow(uint64_t sequence);
+
+private:
+    DurableFile file_;
+    bool sync_each_record_;
+    uint64_t next_sequence_ = 1;
+    std::string record_;
+
+    uint64_t Commit();
+};
+
+// Applies every complete record of the log at path that is newer than search_server.GetLogSequence()
+// and returns how many were applied. A missing file means an empty log; a torn record at the end
+// (crash during a write) is ignored. Call it before attaching a log to search_server,
+// otherwise the replayed records are logged twice.
+int ReplayWriteAheadLog(const std::string& path, SearchServer& search_server);
+
+// Restart recovery: loads the snapshot at snapshot_path into the empty search_server if the file exists,
+// then replays the log records written after it. Returns the number of records replayed
+int RecoverIndex(const std::string& snapshot_path, const std::string& log_path, SearchServer& search_server);